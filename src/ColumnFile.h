@@ -0,0 +1,331 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include "SoaVector.h"
+
+// On disk format for SoaVector tables that is used in place: the reader maps the file and hands out each column as a span
+// straight into the mapping, so opening a table costs a page of header instead of a pass over every row, and pages are
+// only read from disk when a column is first touched. Only tables whose fields are all trivially copyable can be stored,
+// a column of pointers would be meaningless in another process.
+//
+// Layout, little endian like the machines it is written and read on:
+//   Header: magic, version, column count, row count, checksums and each column's offset, size and element size
+//   Columns: one block per field in field order, each starting on a k_columnAlignment boundary
+// The header checksum is always checked on open. The data checksum covers every column and costs a full read of the
+// file, so it is only checked when asked for with VerifyChecksum. Read copies a table out with plain reads instead.
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ColumnFile
+{
+	constexpr char k_magic[8] = { 'S', 'O', 'A', 'T', 'A', 'B', 'L', 'E' };
+	constexpr uint32_t k_version = 1;
+
+	// Page aligned, so every column also starts on a cache line and SIMD loads from the mapping are aligned
+	constexpr uint64_t k_columnAlignment = 4096;
+	constexpr uint32_t k_maxColumns = 8;
+
+	struct ColumnDescriptor
+	{
+		uint64_t offset;
+		uint64_t byteSize;
+		uint32_t elementSize;
+		uint32_t reserved;
+	};
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t columnCount;
+		uint64_t rowCount;
+		uint64_t dataChecksum;
+		uint64_t headerChecksum; // Of the header with this field zeroed
+		ColumnDescriptor columns[k_maxColumns];
+	};
+
+	static_assert(std::is_trivially_copyable_v<Header>);
+
+	// Not cryptographic, only there to catch truncated or corrupted files. Four independent lanes of 8 bytes so verifying
+	// a large table is not one long multiply dependency chain
+	inline uint64_t Checksum(void const* data, size_t size, uint64_t seed = 0)
+	{
+		constexpr uint64_t k_multiplier = 0xff51'afd7'ed55'8ccdull;
+		uint8_t const* bytes = (uint8_t const*)data;
+		uint64_t lanes[4] = { seed ^ 0x9e37'79b9'7f4a'7c15ull, seed + 1, seed + 2, seed + 3 };
+
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				uint64_t word;
+				std::memcpy(&word, bytes + i + lane * 8, sizeof(word));
+				lanes[lane] = (lanes[lane] ^ word) * k_multiplier;
+				lanes[lane] ^= lanes[lane] >> 32;
+			}
+		}
+
+		uint64_t hash = size;
+		for (uint64_t lane : lanes)
+		{
+			hash = (hash ^ lane) * k_multiplier;
+			hash ^= hash >> 32;
+		}
+
+		for (; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * k_multiplier;
+		}
+
+		return hash ^ (hash >> 29);
+	}
+
+	inline uint64_t AlignColumnOffset(uint64_t offset)
+	{
+		return (offset + k_columnAlignment - 1) / k_columnAlignment * k_columnAlignment;
+	}
+
+	inline uint64_t HeaderChecksum(Header header)
+	{
+		header.headerChecksum = 0;
+		return Checksum(&header, sizeof(header));
+	}
+
+	template<typename T>
+	constexpr bool k_isStorable = []<size_t... I>(std::index_sequence<I...>) {
+		return (std::is_trivially_copyable_v<std::tuple_element_t<I, Reflection::FieldTypes<T>>> && ...);
+	}(std::make_index_sequence<Reflection::k_fieldCount<T>>{});
+
+	// nullptr if the header describes a table of T that fits in fileSize bytes, otherwise the reason it does not
+	template<typename T>
+	char const* ValidateHeader(Header const& header, uint64_t fileSize)
+	{
+		if (std::memcmp(header.magic, k_magic, sizeof(k_magic)) != 0) return "Not a column file";
+		if (header.version != k_version) return "Unsupported column file version";
+		if (header.headerChecksum != HeaderChecksum(header)) return "Header checksum mismatch";
+		if (header.columnCount != SoaVector<T>::k_fieldCount) return "Column count does not match the table type";
+
+		char const* columnError = nullptr;
+		Reflection::ForEachField<T>([&](auto field) {
+			ColumnDescriptor const& descriptor = header.columns[field];
+			if (columnError) return;
+			if (descriptor.elementSize != sizeof(typename SoaVector<T>::template FieldType<field>)) columnError = "Column element size does not match the table type";
+			// Divides rather than multiplies, a huge row count could otherwise wrap around to a matching size
+			else if (descriptor.byteSize % descriptor.elementSize != 0 || descriptor.byteSize / descriptor.elementSize != header.rowCount) columnError = "Column size does not match the row count";
+			else if (descriptor.offset % k_columnAlignment != 0) columnError = "Column is not aligned";
+			else if (descriptor.offset > fileSize || descriptor.byteSize > fileSize - descriptor.offset) columnError = "Column runs past the end of the file";
+		});
+
+		return columnError;
+	}
+
+	// Returns false if the file could not be written
+	template<typename T>
+	bool Write(char const* path, SoaVector<T> const& table)
+	{
+		static_assert(k_isStorable<T>, "Only tables of trivially copyable fields can be stored");
+		static_assert(SoaVector<T>::k_fieldCount <= k_maxColumns);
+
+		Header header = {};
+		std::memcpy(header.magic, k_magic, sizeof(k_magic));
+		header.version = k_version;
+		header.columnCount = (uint32_t)SoaVector<T>::k_fieldCount;
+		header.rowCount = table.Size();
+
+		uint64_t offset = sizeof(Header);
+		uint64_t dataChecksum = 0;
+		Reflection::ForEachField<T>([&](auto field) {
+			auto column = table.template Column<field>();
+			ColumnDescriptor& descriptor = header.columns[field];
+			descriptor.offset = AlignColumnOffset(offset);
+			descriptor.byteSize = column.size_bytes();
+			descriptor.elementSize = sizeof(typename decltype(column)::element_type);
+			dataChecksum = Checksum(column.data(), column.size_bytes(), dataChecksum);
+			offset = descriptor.offset + descriptor.byteSize;
+		});
+
+		header.dataChecksum = dataChecksum;
+		header.headerChecksum = HeaderChecksum(header);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+
+		file.write((char const*)&header, sizeof(header));
+		uint64_t written = sizeof(header);
+		Reflection::ForEachField<T>([&](auto field) {
+			auto column = table.template Column<field>();
+			static char const k_padding[k_columnAlignment] = {};
+			file.write(k_padding, (std::streamsize)(header.columns[field].offset - written));
+			file.write((char const*)column.data(), (std::streamsize)column.size_bytes());
+			written = header.columns[field].offset + header.columns[field].byteSize;
+		});
+
+		return (bool)file;
+	}
+
+	// Copies the table into memory with plain reads, for when the table has to be modified or outlive the file.
+	// Returns false if the file could not be read or does not hold a table of T
+	template<typename T>
+	bool Read(char const* path, SoaVector<T>& table)
+	{
+		static_assert(k_isStorable<T>, "Only tables of trivially copyable fields can be stored");
+
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) return false;
+
+		uint64_t fileSize = (uint64_t)file.tellg();
+		Header header;
+		if (fileSize < sizeof(header) || !file.seekg(0).read((char*)&header, sizeof(header))) return false;
+		if (ValidateHeader<T>(header, fileSize)) return false;
+
+		table.Resize((size_t)header.rowCount);
+		Reflection::ForEachField<T>([&](auto field) {
+			auto column = table.template Column<field>();
+			file.seekg((std::streamoff)header.columns[field].offset);
+			file.read((char*)column.data(), (std::streamsize)column.size_bytes());
+		});
+
+		return (bool)file;
+	}
+
+	// Read only view of a table written by Write. Check IsOpen after constructing, GetError says why a file was rejected.
+	// The spans point into the mapping and are valid for the lifetime of this object
+	template<typename T>
+	class MappedTable
+	{
+	public:
+		static_assert(k_isStorable<T>, "Only tables of trivially copyable fields can be stored");
+
+		template<size_t Field>
+		using FieldType = typename SoaVector<T>::template FieldType<Field>;
+
+		explicit MappedTable(char const* path)
+		{
+			if (!Map(path)) return;
+
+			error = size < sizeof(Header) ? "File is smaller than the header" : ValidateHeader<T>(GetHeader(), size);
+			if (error) Unmap();
+		}
+
+		~MappedTable()
+		{
+			Unmap();
+		}
+
+		MappedTable(MappedTable const&) = delete;
+		MappedTable& operator=(MappedTable const&) = delete;
+
+		bool IsOpen() const { return data != nullptr; }
+		char const* GetError() const { return error; }
+
+		size_t Size() const { return (size_t)GetHeader().rowCount; }
+
+		template<size_t Field>
+		std::span<FieldType<Field> const> Column() const
+		{
+			ColumnDescriptor const& descriptor = GetHeader().columns[Field];
+			return { (FieldType<Field> const*)(data + descriptor.offset), Size() };
+		}
+
+		// Reads every column, so this faults in the whole file
+		bool VerifyChecksum() const
+		{
+			uint64_t checksum = 0;
+			Header const& header = GetHeader();
+			for (uint32_t i = 0; i < header.columnCount; ++i)
+			{
+				checksum = Checksum(data + header.columns[i].offset, header.columns[i].byteSize, checksum);
+			}
+
+			return checksum == header.dataChecksum;
+		}
+
+	private:
+		Header const& GetHeader() const { return *(Header const*)data; }
+
+#if _WIN32
+		bool Map(char const* path)
+		{
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) return Fail("Unable to open file");
+
+			LARGE_INTEGER fileSize;
+			HANDLE mapping = nullptr;
+			if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+			{
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			}
+
+			CloseHandle(file);
+			if (!mapping) return Fail("Unable to map file");
+
+			data = (uint8_t const*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (!data) return Fail("Unable to map file");
+
+			size = (size_t)fileSize.QuadPart;
+			return true;
+		}
+
+		void Unmap()
+		{
+			if (data) UnmapViewOfFile(data);
+			data = nullptr;
+			size = 0;
+		}
+#else
+		bool Map(char const* path)
+		{
+			int file = open(path, O_RDONLY);
+			if (file < 0) return Fail("Unable to open file");
+
+			struct stat status;
+			if (fstat(file, &status) != 0 || status.st_size <= 0)
+			{
+				close(file);
+				return Fail("Unable to open file");
+			}
+
+			// The mapping keeps its own reference to the file
+			void* mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+			close(file);
+			if (mapped == MAP_FAILED) return Fail("Unable to map file");
+
+			data = (uint8_t const*)mapped;
+			size = (size_t)status.st_size;
+			return true;
+		}
+
+		void Unmap()
+		{
+			if (data) munmap((void*)data, size);
+			data = nullptr;
+			size = 0;
+		}
+#endif
+
+		bool Fail(char const* reason)
+		{
+			error = reason;
+			return false;
+		}
+
+		uint8_t const* data = nullptr;
+		size_t size = 0;
+		char const* error = nullptr;
+	};
+
+} // namespace ColumnFile
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include "Profiler.h"
+
+// Lets a single function use an instruction set the rest of the build does not assume, only call it after checking CpuFeatures
+// for every extension its target names. Keep these lists to what the dispatchers check, the compiler is free to use any
+// listed extension anywhere in the function. MSVC allows any intrinsic without this
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TargetAvx2
+#define TargetAvx512
+#else
+#define TargetAvx2 __attribute__((target("avx2,popcnt")))
+#define TargetAvx512 __attribute__((target("avx512f,popcnt")))
+#endif
+
+// Instruction set extensions the CPU and OS both support, for picking kernels at runtime.
+// A vector extension is only usable if the OS also saves its registers on a context switch (XCR0)
+struct CpuFeatures
+{
+	bool popcnt = false;
+	bool avx2 = false;
+	bool avx512f = false;
+
+	static CpuFeatures const& Get()
+	{
+		static CpuFeatures const features = Detect();
+		return features;
+	}
+
+private:
+	static CpuFeatures Detect()
+	{
+		CpuFeatures features;
+		uint32_t registers[4];
+
+		Profiler::ReadCpuid(0, 0, registers);
+		uint32_t maxLeaf = registers[0];
+		if (maxLeaf < 1) return features;
+
+		Profiler::ReadCpuid(1, 0, registers);
+		uint32_t leaf1Ecx = registers[2];
+		features.popcnt = (leaf1Ecx >> 23) & 1;
+		bool osSavesVectorState = (leaf1Ecx >> 27) & 1; // OSXSAVE
+		bool avx = (leaf1Ecx >> 28) & 1;
+
+		uint64_t xcr0 = osSavesVectorState ? ReadXcr0() : 0;
+		bool osSavesYmm = (xcr0 & 0x6) == 0x6; // SSE and AVX state
+		bool osSavesZmm = (xcr0 & 0xE6) == 0xE6; // plus opmask and both halves of the zmm state
+
+		if (maxLeaf < 7) return features;
+
+		Profiler::ReadCpuid(7, 0, registers);
+		uint32_t leaf7Ebx = registers[1];
+		features.avx2 = avx && osSavesYmm && ((leaf7Ebx >> 5) & 1);
+		features.avx512f = osSavesZmm && ((leaf7Ebx >> 16) & 1);
+
+		return features;
+	}
+
+	static uint64_t ReadXcr0()
+	{
+#if _WIN32
+		return _xgetbv(0);
+#else
+		uint32_t eax = 0;
+		uint32_t edx = 0;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((uint64_t)edx << 32) | eax;
+#endif
+	}
+};
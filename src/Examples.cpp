@@ -1,12 +1,70 @@
 #include <gtest/gtest.h>
 #include <nanobench.h>
 #include <random>
+#include <bit>
+#include <filesystem>
+#include <fstream>
 #include <memory_resource>
+#include <span>
+#include <unordered_map>
 #include "RepetitionTester.h"
+#include "ResultsExport.h"
+#include "TestBuffer.h"
+#include "CpuFeatures.h"
+#include "KeySearch.h"
+#include "KeyIndex.h"
+#include "FlatHashMap.h"
+#include "SlotMap.h"
+#include "SoaVector.h"
+#include "PredicateCount.h"
+#include "ThreadPool.h"
+#include "TaskScheduler.h"
+#include "MemoryResources.h"
+#include "KeyLookupCoroutines.h"
+#include "ColumnFile.h"
+#include "StreamingScan.h"
 #include "HoistingSamples.cpp"
 
 namespace Bench = ankerl::nanobench;
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Result export
+// Once every test has run, write the profiler and repetition tester results out for tracking between builds.
+// PERF_RESULTS_JSON / PERF_RESULTS_CSV: paths to write results to
+// PERF_BASELINE: CSV from a previous run, any test whose min or median time regressed fails the run
+// PERF_REGRESSION_THRESHOLD: allowed slowdown before a test counts as regressed, defaults to 0.05 (5%)
+class ResultsExportEnvironment : public testing::Environment
+{
+public:
+	void TearDown() override
+	{
+		if (char const* jsonPath = std::getenv("PERF_RESULTS_JSON"))
+		{
+			ResultsExport::WriteFile(jsonPath, &ResultsExport::WriteJson);
+		}
+
+		if (char const* csvPath = std::getenv("PERF_RESULTS_CSV"))
+		{
+			ResultsExport::WriteFile(csvPath, &ResultsExport::WriteCsv);
+		}
+
+		if (char const* baselinePath = std::getenv("PERF_BASELINE"))
+		{
+			double threshold = 0.05;
+			if (char const* thresholdValue = std::getenv("PERF_REGRESSION_THRESHOLD"))
+			{
+				threshold = std::strtod(thresholdValue, nullptr);
+			}
+
+			std::vector<ResultsExport::Regression> regressions = ResultsExport::CompareToBaseline(ResultsExport::LoadBaselineCsv(baselinePath), threshold);
+			ResultsExport::PrintRegressions(regressions);
+			EXPECT_TRUE(regressions.empty()) << regressions.size() << " results regressed against " << baselinePath;
+		}
+	}
+};
+
+testing::Environment* const g_resultsExportEnvironment = testing::AddGlobalTestEnvironment(new ResultsExportEnvironment);
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Execution port examples
 // These functions just call mov sequentially to either read or store data.
@@ -14,6 +72,7 @@ namespace Bench = ankerl::nanobench;
 // a hard limit form on some sequential count. This indicates that the execution ports are maxed out as the CPU cannot parallelize these
 // instructions further, even though it theoretically could execute more of these functions in parallel as there are no dependency chains
 // between them.
+#if HAS_MOVS_KERNELS
 extern "C" void Mov1x(uint64_t count, uint8_t * data);
 extern "C" void Mov2x(uint64_t count, uint8_t * data);
 extern "C" void Mov3x(uint64_t count, uint8_t * data);
@@ -22,78 +81,382 @@ extern "C" void Store1x(uint64_t count, uint8_t * data);
 extern "C" void Store2x(uint64_t count, uint8_t * data);
 extern "C" void Store3x(uint64_t count, uint8_t * data);
 extern "C" void Store4x(uint64_t count, uint8_t * data);
-#pragma comment(lib, "movs")
+#endif // HAS_MOVS_KERNELS
 
 using RepetitionTestFn = std::function<void(uint64_t count, uint8_t* pData)>;
 uint32_t const k_gb = 1024 * 1024 * 1024;
 
-void RepetitionTest(std::string const& testName, RepetitionTestFn const& fn)
+// Runs the test once per buffer policy, each reported as its own result, so the cost of faulting pages in
+// (fresh) can be separated from the raw bandwidth of the loop (reused, prefaulted and huge pages)
+void RepetitionTest(std::string const& testName, RepetitionTestFn const& fn, std::span<BufferPolicy const> policies = k_bufferPolicies)
+{
+	for (BufferPolicy policy : policies)
+	{
+		TestBuffer buffer(policy, k_gb);
+		if (!buffer.Acquire()) continue;
+
+		TestParameters params{
+			.expectedBytesToProcessPerTest = k_gb,
+			.testName = testName + " (" + GetBufferPolicyName(policy) + ")",
+			.numSecondsToFindNewResult = 2
+		};
+
+		RepetitionTester tester(params);
+
+		while (tester.IsTesting())
+		{
+			uint8_t* data = buffer.Acquire();
+
+			tester.BeginTest();
+			fn(buffer.Size(), data);
+			tester.EndTest(k_gb);
+		}
+
+		tester.PrintResults();
+	}
+}
+
+TEST(BufferPolicies, writeBytes)
+{
+	RepetitionTest("writeBytes", [](uint64_t count, uint8_t* data) {
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			data[i] = (uint8_t)i;
+		}
+	});
+}
+
+//test
+//allocate memory buffer that is large enough to hit main memory
+//Count bytes read per cycle
+//ouput result
+
+#if HAS_MOVS_KERNELS
+// The kernels only touch a single address, so page faulting policies make no difference
+BufferPolicy const k_portTestPolicies[] = { BufferPolicy::Reused };
+
+TEST(ExecutionPorts, mov1x)
+{
+	RepetitionTest("mov1x", &Mov1x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, mov2x)
+{
+	RepetitionTest("mov2x", &Mov2x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, mov3x)
+{
+	RepetitionTest("mov3x", &Mov3x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, mov4x)
+{
+	RepetitionTest("mov4x", &Mov4x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, store1x)
+{
+	RepetitionTest("store1x", &Store1x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, store2x)
+{
+	RepetitionTest("store2x", &Store2x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, store3x)
+{
+	RepetitionTest("store3x", &Store3x, k_portTestPolicies);
+}
+
+TEST(ExecutionPorts, store4x)
+{
+	RepetitionTest("store4x", &Store4x, k_portTestPolicies);
+}
+#endif // HAS_MOVS_KERNELS
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Cache hierarchy bandwidth sweep
+// Reads, writes and read-modify-writes a working set that doubles in size from 4kb up to several gb, at 8, 16, 32 (AVX2)
+// and 64 (AVX-512) bytes per access. Bandwidth holds steady while the working set fits in a level of the cache hierarchy
+// and falls off a cliff each time it spills into the next one, plotting gb/s against size shows where L1, L2, L3 and DRAM begin.
+constexpr uint64_t k_sweepMinWorkingSet = 4 * 1024;
+
+// PERF_SWEEP_MAX_BYTES overrides the largest working set, rounded down to a power of two
+uint64_t GetSweepMaxWorkingSet()
+{
+	uint64_t maxWorkingSet = 4ull * k_gb;
+	if (char const* maxBytes = std::getenv("PERF_SWEEP_MAX_BYTES"))
+	{
+		maxWorkingSet = std::max<uint64_t>(std::strtoull(maxBytes, nullptr, 10), k_sweepMinWorkingSet);
+	}
+
+	return std::bit_floor(maxWorkingSet);
+}
+
+std::string FormatBytes(uint64_t bytes)
+{
+	if (bytes >= k_gb) return std::to_string(bytes / k_gb) + "gb";
+	if (bytes >= 1024 * 1024) return std::to_string(bytes / (1024 * 1024)) + "mb";
+	return std::to_string(bytes / 1024) + "kb";
+}
+
+#if HAS_MOVS_KERNELS
+extern "C" void Read8(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Read16(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Read32(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Read64(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Write8(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Write16(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Write32(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void Write64(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void ReadWrite8(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void ReadWrite16(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void ReadWrite32(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+extern "C" void ReadWrite64(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+
+using BandwidthKernelFn = void (*)(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask);
+
+constexpr uint64_t k_sweepBytesPerTest = 256 * 1024 * 1024;
+
+void BandwidthSweep(std::string const& kernelName, BandwidthKernelFn kernel)
+{
+	uint64_t maxWorkingSet = GetSweepMaxWorkingSet();
+	TestBuffer buffer(BufferPolicy::PreFaulted, maxWorkingSet);
+	uint8_t* data = buffer.Acquire();
+	if (!data)
+	{
+		GTEST_SKIP() << "Unable to allocate " << FormatBytes(maxWorkingSet) << ", set PERF_SWEEP_MAX_BYTES lower";
+	}
+
+	std::cout << kernelName << " bandwidth:\n";
+	for (uint64_t workingSet = k_sweepMinWorkingSet; workingSet <= maxWorkingSet; workingSet *= 2)
+	{
+		// Small working sets are looped over many times, large ones are passed over once per test
+		uint64_t bytesPerTest = std::max(k_sweepBytesPerTest, workingSet);
+
+		TestParameters params{
+			.expectedBytesToProcessPerTest = bytesPerTest,
+			.testName = kernelName + " " + FormatBytes(workingSet),
+			.numSecondsToFindNewResult = 1,
+			.stopRule = TestStopRule::ConfidenceInterval,
+			.minSamplesToConverge = 10,
+			.maxSecondsToConverge = 5
+		};
+
+		RepetitionTester tester(params);
+
+		while (tester.IsTesting())
+		{
+			tester.BeginTest();
+			kernel(bytesPerTest, data, workingSet - 1);
+			tester.EndTest(bytesPerTest);
+		}
+
+		TestSummary summary = tester.GetSummary();
+		std::cout << "\t" << FormatBytes(workingSet) << ": "
+			<< ResultsExport::GigabytesPerSecond(bytesPerTest, (double)summary.minClockCycles) << "gb/s (min time) "
+			<< ResultsExport::GigabytesPerSecond(bytesPerTest, summary.stats.median) << "gb/s (median time)\n";
+	}
+}
+
+#define BandwidthSweepTest(kernel, requiredFeature) \
+	TEST(BandwidthSweep, kernel) \
+	{ \
+		if (!(requiredFeature)) GTEST_SKIP() << #requiredFeature << " not supported"; \
+		BandwidthSweep(#kernel, &kernel); \
+	}
+
+BandwidthSweepTest(Read8, true)
+BandwidthSweepTest(Read16, true)
+BandwidthSweepTest(Read32, CpuFeatures::Get().avx2)
+BandwidthSweepTest(Read64, CpuFeatures::Get().avx512f)
+BandwidthSweepTest(Write8, true)
+BandwidthSweepTest(Write16, true)
+BandwidthSweepTest(Write32, CpuFeatures::Get().avx2)
+BandwidthSweepTest(Write64, CpuFeatures::Get().avx512f)
+BandwidthSweepTest(ReadWrite8, true)
+BandwidthSweepTest(ReadWrite16, true)
+BandwidthSweepTest(ReadWrite32, CpuFeatures::Get().avx2)
+BandwidthSweepTest(ReadWrite64, CpuFeatures::Get().avx512f)
+#endif // HAS_MOVS_KERNELS
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Memory latency
+// Follows pointers through a random cycle of cache lines, so every load depends on the one before it and the prefetchers
+// cannot guess the next line. The time per load is the load to use latency of whichever level the working set fits in,
+// the cost every pointer payload lookup pays. Running several independent chains at once shows how many misses the core
+// keeps in flight (memory level parallelism), and 4kb against huge pages shows how much of a miss is the page walk.
+
+constexpr uint64_t k_cacheLineSize = 64;
+constexpr uint64_t k_latencyLoadsPerTest = 1 << 18;
+constexpr uint32_t k_latencyChainCounts[] = { 1, 2, 4, 8, 16 };
+constexpr uint32_t k_maxLatencyChains = 16;
+
+// Every page is touched while the chase is built, so none of the policies fault during the timed loads
+BufferPolicy const k_latencyPolicies[] = { BufferPolicy::PreFaulted, BufferPolicy::TransparentHugePages, BufferPolicy::ExplicitHugePages };
+
+// Building the cycle costs a shuffle of every line, so the latency sweep stops at 1gb unless PERF_SWEEP_MAX_BYTES is lower
+uint64_t GetLatencyMaxWorkingSet()
+{
+	return std::min<uint64_t>(GetSweepMaxWorkingSet(), k_gb);
+}
+
+// Links every cache line of the working set into a single cycle in random order, one pointer at the start of each line.
+// The chains start evenly spaced around the cycle, so they never run into each other's lines
+void BuildPointerChase(uint8_t* data, uint64_t workingSet, uint32_t chainCount, void** starts)
+{
+	uint32_t lineCount = (uint32_t)(workingSet / k_cacheLineSize);
+	std::vector<uint32_t> order(lineCount);
+	for (uint32_t i = 0; i < lineCount; ++i)
+	{
+		order[i] = i;
+	}
+
+	std::mt19937 generator(lineCount);
+	std::shuffle(order.begin(), order.end(), generator);
+
+	for (uint32_t i = 0; i < lineCount; ++i)
+	{
+		uint32_t next = order[(i + 1) % lineCount];
+		*(void**)(data + order[i] * k_cacheLineSize) = data + next * k_cacheLineSize;
+	}
+
+	for (uint32_t chain = 0; chain < chainCount; ++chain)
+	{
+		starts[chain] = data + order[(uint64_t)lineCount * chain / chainCount] * k_cacheLineSize;
+	}
+}
+
+// The chains advance in lock step, each load only waits on the previous load of its own chain
+template<uint32_t ChainCount>
+uintptr_t ChasePointers(void* const* starts, uint64_t steps)
+{
+	void* current[ChainCount];
+	for (uint32_t chain = 0; chain < ChainCount; ++chain)
+	{
+		current[chain] = starts[chain];
+	}
+
+	for (uint64_t step = 0; step < steps; ++step)
+	{
+		for (uint32_t chain = 0; chain < ChainCount; ++chain)
+		{
+			current[chain] = *(void**)current[chain];
+		}
+	}
+
+	uintptr_t end = 0;
+	for (uint32_t chain = 0; chain < ChainCount; ++chain)
+	{
+		end ^= (uintptr_t)current[chain];
+	}
+
+	return end;
+}
+
+using ChasePointersFn = uintptr_t(*)(void* const* starts, uint64_t steps);
+
+// The chain count is a template parameter so every chain stays in a register
+ChasePointersFn GetChasePointersKernel(uint32_t chainCount)
+{
+	switch (chainCount)
+	{
+	case 1: return &ChasePointers<1>;
+	case 2: return &ChasePointers<2>;
+	case 4: return &ChasePointers<4>;
+	case 8: return &ChasePointers<8>;
+	case 16: return &ChasePointers<16>;
+	}
+
+	return nullptr;
+}
+
+struct LoadLatency
+{
+	double cyclesPerLoad = 0.0;
+	double nanosecondsPerLoad = 0.0;
+};
+
+// Cycles per load from the fastest test, with chainCount chains sharing the first workingSet bytes of data
+LoadLatency MeasureLoadLatency(std::string const& testName, uint8_t* data, uint64_t workingSet, uint32_t chainCount)
 {
+	void* starts[k_maxLatencyChains];
+	BuildPointerChase(data, workingSet, chainCount, starts);
+	ChasePointersFn chase = GetChasePointersKernel(chainCount);
+	uint64_t steps = k_latencyLoadsPerTest / chainCount;
+	uint64_t loadCount = steps * chainCount;
+
+	// Bytes are the cache lines pulled in, one per load
 	TestParameters params{
-		.expectedBytesToProcessPerTest = k_gb,
+		.expectedBytesToProcessPerTest = loadCount * k_cacheLineSize,
 		.testName = testName,
-		.numSecondsToFindNewResult = 2
+		.numSecondsToFindNewResult = 1,
+		.stopRule = TestStopRule::ConfidenceInterval,
+		.minSamplesToConverge = 10,
+		.maxSecondsToConverge = 2
 	};
 
 	RepetitionTester tester(params);
 
 	while (tester.IsTesting())
 	{
-		std::vector<uint8_t> mem;
-		mem.resize(k_gb);
-
 		tester.BeginTest();
-		fn(mem.size(), mem.data());
-		tester.EndTest(k_gb);
+		Bench::doNotOptimizeAway(chase(starts, steps));
+		tester.EndTest(loadCount * k_cacheLineSize);
 	}
 
-	tester.PrintResults();
+	LoadLatency latency;
+	latency.cyclesPerLoad = (double)tester.GetSummary().minClockCycles / (double)loadCount;
+	latency.nanosecondsPerLoad = latency.cyclesPerLoad * 1e9 / (double)Profiler::CpuStats::Get().k_CpuFrequencyHz;
+	return latency;
 }
 
-//test
-//allocate memory buffer that is large enough to hit main memory
-//Count bytes read per cycle
-//ouput result
+// One chain, working set doubling from 4kb, latency steps up at each cache level and again once the TLB runs out
+TEST(MemoryLatency, workingSetSweep)
+{
+	uint64_t maxWorkingSet = GetLatencyMaxWorkingSet();
+	for (BufferPolicy policy : k_latencyPolicies)
+	{
+		TestBuffer buffer(policy, maxWorkingSet);
+		uint8_t* data = buffer.Acquire();
+		if (!data) continue;
+
+		std::cout << "Pointer chase latency (" << GetBufferPolicyName(policy) << "):\n";
+		for (uint64_t workingSet = k_sweepMinWorkingSet; workingSet <= maxWorkingSet; workingSet *= 2)
+		{
+			std::string testName = "pointer chase " + FormatBytes(workingSet) + " (" + GetBufferPolicyName(policy) + ")";
+			LoadLatency latency = MeasureLoadLatency(testName, data, workingSet, 1);
+			std::cout << "\t" << FormatBytes(workingSet) << ": " << latency.nanosecondsPerLoad << "ns/load " << latency.cyclesPerLoad << " cycles/load\n";
+		}
+	}
+}
 
-//TEST(ExecutionPorts, mov1x)
-//{
-//	RepetitionTest("mov1x", &Mov1x);
-//}
-//
-//TEST(ExecutionPorts, mov2x)
-//{
-//	RepetitionTest("mov2x", &Mov2x);
-//}
-//
-//TEST(ExecutionPorts, mov3x)
-//{
-//	RepetitionTest("mov3x", &Mov3x);
-//}
-//
-//TEST(ExecutionPorts, mov4x)
-//{
-//	RepetitionTest("mov4x", &Mov4x);
-//}
-//
-//TEST(ExecutionPorts, store1x)
-//{
-//	RepetitionTest("store1x", &Store1x);
-//}
-//
-//TEST(ExecutionPorts, store2x)
-//{
-//	RepetitionTest("store2x", &Store2x);
-//}
-//
-//TEST(ExecutionPorts, store3x)
-//{
-//	RepetitionTest("store3x", &Store3x);
-//}
-//
-//TEST(ExecutionPorts, store4x)
-//{
-//	RepetitionTest("store4x", &Store4x);
-//}
+// Largest working set, more independent chains. Time per load falls while the extra misses overlap and flattens once the
+// core runs out of line fill buffers
+TEST(MemoryLatency, memoryLevelParallelism)
+{
+	uint64_t workingSet = GetLatencyMaxWorkingSet();
+	for (BufferPolicy policy : k_latencyPolicies)
+	{
+		TestBuffer buffer(policy, workingSet);
+		uint8_t* data = buffer.Acquire();
+		if (!data) continue;
+
+		std::cout << "Pointer chase " << FormatBytes(workingSet) << " (" << GetBufferPolicyName(policy) << "):\n";
+		double singleChainCycles = 0.0;
+		for (uint32_t chainCount : k_latencyChainCounts)
+		{
+			std::string testName = "pointer chase " + std::to_string(chainCount) + " chains (" + GetBufferPolicyName(policy) + ")";
+			LoadLatency latency = MeasureLoadLatency(testName, data, workingSet, chainCount);
+			if (chainCount == 1) singleChainCycles = latency.cyclesPerLoad;
+
+			std::cout << "\t" << chainCount << " chains: " << latency.nanosecondsPerLoad << "ns/load " << latency.cyclesPerLoad << " cycles/load "
+				<< singleChainCycles / latency.cyclesPerLoad << "x one chain\n";
+		}
+	}
+}
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Structure of Arrays example
@@ -123,11 +486,10 @@ struct kv
 	Junk j;
 };
 
-struct kv_soa
-{
-	std::vector<uint32_t> keys;
-	std::vector<Junk> j;
-};          
+// The structure of arrays layouts are derived from the structs, column indices follow their field order
+using kv_soa = SoaVector<kv>;
+constexpr size_t k_keyColumn = 0;
+constexpr size_t k_valueColumn = 1;
 
 bool Search(kv* data, uint32_t target)
 {
@@ -170,132 +532,1507 @@ TEST(StructureOfArrays, ArrayOfStructs)
 TEST(StructureOfArrays, StructureOfArrays)
 {
 	kv_soa kvs;
-	kvs.keys.resize(k_arraySize);
-	kvs.j.resize(k_arraySize);
+	kvs.Resize(k_arraySize);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
 	for (int i = 0; i < k_arraySize; i++)
 	{
-		kvs.keys[i] = i;
+		keys[i] = i;
 	}
 
 	std::mt19937 generator(k_randomSeed);
 
 	Bench::Bench().minEpochIterations(1000).run("StructOfArrays", [&] {
 		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
-		Bench::doNotOptimizeAway(Search(kvs.keys.data(), target));
+		Bench::doNotOptimizeAway(Search(keys.data(), target));
 	});
 }
 
-struct kvp
+// The same structure of arrays search with SIMD kernels, comparing 4 (SSE), 8 (AVX2) or 16 (AVX-512) keys per instruction
+void StructureOfArraysSimdTest(char const* name, KeySearch::FindKeyFn findKey)
 {
-	uint32_t key;
-	std::shared_ptr<uint32_t> pData;
-};
+	kv_soa kvs;
+	kvs.Resize(k_arraySize);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+	for (uint32_t i = 0; i < k_arraySize; i++)
+	{
+		keys[i] = i;
+	}
+
+	for (uint32_t target : { 0u, 5u, 63u, 64u, k_arraySize - 1, k_arraySize })
+	{
+		EXPECT_EQ(findKey(keys.data(), k_arraySize, target), KeySearch::FindKeyScalar(keys.data(), k_arraySize, target));
+	}
+
+	std::mt19937 generator(k_randomSeed);
+
+	Bench::Bench().minEpochIterations(1000).run(name, [&] {
+		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
+		Bench::doNotOptimizeAway(findKey(keys.data(), k_arraySize, target));
+	});
+}
+
+TEST(StructureOfArrays, StructureOfArraysSse)
+{
+	StructureOfArraysSimdTest("StructOfArrays SSE", &KeySearch::FindKeySse);
+}
+
+TEST(StructureOfArrays, StructureOfArraysAvx2)
+{
+	if (!CpuFeatures::Get().avx2 || !CpuFeatures::Get().popcnt) GTEST_SKIP() << "AVX2 not supported";
+	StructureOfArraysSimdTest("StructOfArrays AVX2", &KeySearch::FindKeyAvx2);
+}
 
-struct kvp_soa
+TEST(StructureOfArrays, StructureOfArraysAvx512)
 {
-	std::vector<uint32_t> keys;
-	std::vector<std::shared_ptr<uint32_t>> data;
+	if (!CpuFeatures::Get().avx512f || !CpuFeatures::Get().popcnt) GTEST_SKIP() << "AVX-512 not supported";
+	StructureOfArraysSimdTest("StructOfArrays AVX-512", &KeySearch::FindKeyAvx512);
+}
+
+TEST(StructureOfArrays, StructureOfArraysDispatched)
+{
+	StructureOfArraysSimdTest("StructOfArrays dispatched", &KeySearch::FindKey);
+}
+
+// Search for a key that is not present so every run scans the whole array, and read hardware counters
+// alongside the cycle counts to show where the AoS search loses time (cache misses from dragging Junk through the cache)
+std::vector<HardwareCounter> const k_searchCounters = {
+	HardwareCounter::Instructions,
+	HardwareCounter::CoreCycles,
+	HardwareCounter::CacheMisses,
+	HardwareCounter::BranchMisses,
+	HardwareCounter::L1DataReadMisses,
 };
 
-bool Search(kvp* data, uint32_t target)
+template<typename SearchFn>
+void SearchCountersTest(std::string const& testName, uint64_t bytesPerSearch, SearchFn const& search)
 {
-	for (uint32_t i = 0; i < k_arraySize; i++)
+	TestParameters params{
+		.expectedBytesToProcessPerTest = bytesPerSearch,
+		.testName = testName,
+		.numSecondsToFindNewResult = 2,
+		.hardwareCounters = k_searchCounters
+	};
+
+	RepetitionTester tester(params);
+
+	while (tester.IsTesting())
 	{
-		if (data[i].key == target) return true;
+		tester.BeginTest();
+		Bench::doNotOptimizeAway(search(k_arraySize));
+		tester.EndTest(bytesPerSearch);
 	}
 
-	return false;
+	tester.PrintResults();
 }
 
-TEST(StructureOfArrays, ArrayOfStructsPointer)
+TEST(StructureOfArrays, ArrayOfStructsCounters)
 {
-	std::vector<kvp> kvs;
+	std::vector<kv> kvs;
 	kvs.resize(k_arraySize);
-	for (int i = 0; i < k_arraySize; i++)
+	for (uint32_t i = 0; i < k_arraySize; i++)
 	{
 		kvs[i].key = i;
-		kvs[i].pData = std::make_shared<uint32_t>(i);
 	}
 
-	std::mt19937 generator(k_randomSeed);
-
-	Bench::Bench().minEpochIterations(1000).run("ArrayOfStructs", [&] {
-		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
-		Bench::doNotOptimizeAway(Search(kvs.data(), target));
+	SearchCountersTest("ArrayOfStructs counters", k_arraySize * sizeof(kv), [&](uint32_t target) {
+		return Search(kvs.data(), target);
 	});
 }
 
-TEST(StructureOfArrays, StructureOfArraysPointer)
+TEST(StructureOfArrays, StructureOfArraysCounters)
 {
-	kvp_soa kvs;
-	kvs.keys.resize(k_arraySize);
-	kvs.data.resize(k_arraySize);
-	for (int i = 0; i < k_arraySize; i++)
+	kv_soa kvs;
+	kvs.Resize(k_arraySize);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+	for (uint32_t i = 0; i < k_arraySize; i++)
 	{
-		kvs.keys[i] = i;
-		kvs.data[i] = std::make_shared<uint32_t>(i);
+		keys[i] = i;
 	}
 
-	std::mt19937 generator(k_randomSeed);
-	Bench::Bench().minEpochIterations(1000).run("StructOfArrays", [&] {
-		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
-		Bench::doNotOptimizeAway(Search(kvs.keys.data(), target));
+	SearchCountersTest("StructOfArrays counters", k_arraySize * sizeof(uint32_t), [&](uint32_t target) {
+		return Search(keys.data(), target);
 	});
 }
 
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-//Hoisting Example
-//We want to help our compilers by explicitly hoisting out loop-invariants
-// we also want to reduce branch mis-predictions by arranging our data and processing in such a way that we minimise branches taken
-// and if we do have to have a low level branch then the data that we are branching on helps the branch predictor as much as possible
-// Ideally we remove branches in general and operate with masking operations
+// Layout experiments driven by the containers instead of hand written parallel structs. kv_hot_cold is kv with Junk
+// flattened, so each of its fields gets a column and a loop that only reads the key and a leaves b, c and d out of the cache
+struct kv_hot_cold
+{
+	uint32_t key;
+	uint64_t a;
+	uint64_t b;
+	uint64_t c;
+	uint64_t d;
+};
 
-constexpr uint32_t k_branchArraySize = 100'000;
+constexpr size_t k_hotColumn = 1;
 
-//low-level unsorted branch
-TEST(Hoisting, randomBranching)
+TEST(StructureOfArrays, SoaVectorCorrectness)
 {
-	std::mt19937 generator(k_randomSeed);
-	uint32_t data[k_branchArraySize];
+	static_assert(Reflection::k_fieldCount<kv> == 2);
+	static_assert(Reflection::k_fieldCount<kv_hot_cold> == 5);
 
-	for (uint32_t i = 0; i < k_branchArraySize; i++)
+	SoaVector<kv_hot_cold> soa;
+	AosoaVector<kv_hot_cold, 8> aosoa;
+	for (uint32_t i = 0; i < 100; i++)
 	{
-		data[i] = GenerateInRange(generator, 0, 10'000);
+		kv_hot_cold value{ i, i * 2ull, i * 3ull, i * 4ull, i * 5ull };
+		soa.PushBack(value);
+		aosoa.PushBack(value);
 	}
 
-	uint64_t sum = 0;
-
-	Bench::Bench().minEpochIterations(1000).run("randomBranching", [&]
+	ASSERT_EQ(soa.Size(), 100u);
+	ASSERT_EQ(aosoa.Size(), 100u);
+	ASSERT_EQ(aosoa.TileCount(), 13u);
+	ASSERT_EQ(aosoa.Column<k_keyColumn>(12).size(), 4u);
+	for (uint32_t i = 0; i < 100; i++)
 	{
-		for (uint32_t i = 0; i < k_branchArraySize; i++)
-		{
-			if (data[i] > 5'000) sum++;
-		}
-	});
+		ASSERT_EQ(soa.Column<k_keyColumn>()[i], i);
+		ASSERT_EQ(soa.Column<k_hotColumn>()[i], i * 2ull);
+		ASSERT_EQ(soa.Get(i).d, i * 5ull);
+		ASSERT_EQ(aosoa.Column<k_hotColumn>(i / 8)[i % 8], i * 2ull);
+		ASSERT_EQ(aosoa.Get(i).d, i * 5ull);
+	}
 }
 
-//sorted branch
-TEST(Hoisting, sortedBranch)
+// Sum a over the rows whose key matches a predicate, every row reads its key and a quarter of them read a
+TEST(StructureOfArrays, HotColdSplit)
 {
-	std::mt19937 generator(k_randomSeed);
-	uint32_t data[k_branchArraySize];
-
-	for (uint32_t i = 0; i < k_branchArraySize; i++)
+	std::vector<kv> aos(k_arraySize);
+	kv_soa soa;
+	SoaVector<kv_hot_cold> hotCold;
+	AosoaVector<kv_hot_cold, 16> tiled16;
+	AosoaVector<kv_hot_cold, 64> tiled64;
+	soa.Reserve(k_arraySize);
+	hotCold.Reserve(k_arraySize);
+	for (uint32_t i = 0; i < k_arraySize; i++)
+	{
+		aos[i] = { i, Junk{ i, i, i, i } };
+		soa.PushBack(aos[i]);
+		kv_hot_cold value{ i, i, i, i, i };
+		hotCold.PushBack(value);
+		tiled16.PushBack(value);
+		tiled64.PushBack(value);
+	}
+
+	auto sweepTiles = [](auto const& tiled) {
+		uint64_t sum = 0;
+		for (size_t tile = 0; tile < tiled.TileCount(); tile++)
+		{
+			std::span<uint32_t const> keys = tiled.template Column<k_keyColumn>(tile);
+			std::span<uint64_t const> hot = tiled.template Column<k_hotColumn>(tile);
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if ((keys[i] & 3) == 0) sum += hot[i];
+			}
+		}
+
+		return sum;
+	};
+
+	Bench::Bench bench;
+	bench.title("Hot/cold split sweep").relative(true).minEpochIterations(100);
+	bench.run("ArrayOfStructs", [&] {
+		uint64_t sum = 0;
+		for (kv const& entry : aos)
+		{
+			if ((entry.key & 3) == 0) sum += entry.j.a;
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	bench.run("SoaVector<kv>", [&] {
+		std::span<uint32_t const> keys = std::as_const(soa).Column<k_keyColumn>();
+		std::span<Junk const> values = std::as_const(soa).Column<k_valueColumn>();
+		uint64_t sum = 0;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if ((keys[i] & 3) == 0) sum += values[i].a;
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	bench.run("SoaVector<kv_hot_cold>", [&] {
+		std::span<uint32_t const> keys = std::as_const(hotCold).Column<k_keyColumn>();
+		std::span<uint64_t const> hot = std::as_const(hotCold).Column<k_hotColumn>();
+		uint64_t sum = 0;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if ((keys[i] & 3) == 0) sum += hot[i];
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	bench.run("AosoaVector<kv_hot_cold, 16>", [&] { Bench::doNotOptimizeAway(sweepTiles(tiled16)); });
+	bench.run("AosoaVector<kv_hot_cold, 64>", [&] { Bench::doNotOptimizeAway(sweepTiles(tiled64)); });
+}
+
+// Sorted key indexes against the linear scans, the keys are filled in sorted order so a linear scan throws that away.
+// Binary search wins from a few hundred keys, the Eytzinger and S-tree layouts pull further ahead once the keys fall out of cache.
+constexpr uint32_t k_keyIndexSizes[] = { 1'000, 10'000, 100'000, 1'000'000 };
+
+template<typename KeyIndex>
+void CheckKeyIndex(std::vector<uint32_t> const& keys)
+{
+	KeyIndex index(keys);
+	std::mt19937 generator(k_randomSeed);
+	for (int i = 0; i < 1000; i++)
+	{
+		uint32_t target = GenerateInRange(generator, 0, (uint32_t)keys.size() * 2);
+		ASSERT_EQ(index.Find(target), KeySearch::FindKeyScalar(keys.data(), keys.size(), target));
+	}
+}
+
+TEST(StructureOfArrays, KeyIndexCorrectness)
+{
+	// Shuffled, with duplicates and gaps, so positions have to map back to the original column
+	std::vector<uint32_t> keys(10'007);
+	std::mt19937 generator(k_randomSeed);
+	for (uint32_t& key : keys)
+	{
+		key = GenerateInRange(generator, 0, (uint32_t)keys.size() * 2);
+	}
+
+	CheckKeyIndex<KeySearch::SortedKeyIndex>(keys);
+	CheckKeyIndex<KeySearch::EytzingerKeyIndex>(keys);
+	CheckKeyIndex<KeySearch::STreeKeyIndex>(keys);
+}
+
+template<typename FindFn>
+void KeyIndexBench(Bench::Bench& bench, char const* name, kv_soa const& kvs, FindFn const& find)
+{
+	std::mt19937 generator(k_randomSeed);
+	uint32_t keyCount = (uint32_t)kvs.Size();
+	std::span<Junk const> values = kvs.Column<k_valueColumn>();
+
+	bench.run(name, [&] {
+		uint32_t target = GenerateInRange(generator, 0, keyCount - 1);
+		size_t index = find(target);
+		Bench::doNotOptimizeAway(index == KeySearch::k_notFound ? 0 : values[index].a);
+	});
+}
+
+TEST(StructureOfArrays, KeyIndex)
+{
+	for (uint32_t keyCount : k_keyIndexSizes)
+	{
+		kv_soa kvs;
+		kvs.Resize(keyCount);
+		std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+		for (uint32_t i = 0; i < keyCount; i++)
+		{
+			keys[i] = i;
+		}
+
+		KeySearch::SortedKeyIndex sorted(keys);
+		KeySearch::EytzingerKeyIndex eytzinger(keys);
+		KeySearch::STreeKeyIndex sTree(keys);
+
+		Bench::Bench bench;
+		bench.title("Key index " + std::to_string(keyCount) + " keys").relative(true).minEpochIterations(1000);
+
+		KeyIndexBench(bench, "Linear", kvs, [&](uint32_t target) { return KeySearch::FindKeyScalar(keys.data(), keyCount, target); });
+		KeyIndexBench(bench, "Linear SIMD", kvs, [&](uint32_t target) { return KeySearch::FindKey(keys.data(), keyCount, target); });
+		KeyIndexBench(bench, "Binary search", kvs, [&](uint32_t target) { return sorted.Find(target); });
+		KeyIndexBench(bench, "Eytzinger", kvs, [&](uint32_t target) { return eytzinger.Find(target); });
+		KeyIndexBench(bench, "S-tree", kvs, [&](uint32_t target) { return sTree.Find(target); });
+	}
+}
+
+// Hash maps from key to Junk, against std::unordered_map (a node allocation and a pointer chase per key) and, at the
+// size the scans above use, the SIMD linear search. Keys are spread out so the maps cannot get lucky with an identity hash
+constexpr uint32_t k_hashMapSizes[] = { k_arraySize, 1'000'000, 4'000'000 };
+
+inline uint32_t HashMapKey(uint32_t i) { return i * 2654435761u; }
+
+TEST(StructureOfArrays, FlatHashMapCorrectness)
+{
+	// Random inserts, overwrites and erases over a small key range, so the map rehashes, reuses tombstones and wraps its probes
+	FlatHashMap<uint32_t, Junk> map;
+	std::unordered_map<uint32_t, Junk> expected;
+	std::mt19937 generator(k_randomSeed);
+	for (uint64_t i = 0; i < 200'000; i++)
+	{
+		uint32_t key = GenerateInRange(generator, 0, 20'000);
+		uint32_t operation = GenerateInRange(generator, 0, 2);
+		if (operation == 0)
+		{
+			Junk value{ i, i, i, i };
+			ASSERT_EQ(map.Insert(key, value), expected.insert_or_assign(key, value).second);
+		}
+		else if (operation == 1)
+		{
+			ASSERT_EQ(map.Erase(key), expected.erase(key) == 1);
+		}
+		else
+		{
+			Junk const* found = map.Find(key);
+			auto it = expected.find(key);
+			ASSERT_EQ(found != nullptr, it != expected.end());
+			if (found)
+			{
+				ASSERT_EQ(found->a, it->second.a);
+			}
+		}
+	}
+
+	ASSERT_EQ(map.Size(), expected.size());
+}
+
+TEST(StructureOfArrays, FlatHashMap)
+{
+	for (uint32_t keyCount : k_hashMapSizes)
+	{
+		kv_soa kvs;
+		kvs.Resize(keyCount);
+		std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+		std::span<Junk> values = kvs.Column<k_valueColumn>();
+		FlatHashMap<uint32_t, Junk> flatMap(keyCount);
+		std::unordered_map<uint32_t, Junk> unorderedMap;
+		unorderedMap.reserve(keyCount);
+		for (uint32_t i = 0; i < keyCount; i++)
+		{
+			keys[i] = HashMapKey(i);
+			flatMap.Insert(HashMapKey(i), values[i]);
+			unorderedMap.emplace(HashMapKey(i), values[i]);
+		}
+
+		std::mt19937 generator(k_randomSeed);
+		Bench::Bench bench;
+		bench.title("Hash map " + std::to_string(keyCount) + " keys").relative(true).minEpochIterations(1000);
+
+		// A linear scan of millions of keys takes long enough to drown out the rest of the table
+		if (keyCount <= k_arraySize)
+		{
+			bench.run("Linear SIMD hit", [&] {
+				size_t index = KeySearch::FindKey(keys.data(), keyCount, HashMapKey(GenerateInRange(generator, 0, keyCount - 1)));
+				Bench::doNotOptimizeAway(index == KeySearch::k_notFound ? 0 : values[index].a);
+			});
+		}
+
+		bench.run("std::unordered_map hit", [&] {
+			auto it = unorderedMap.find(HashMapKey(GenerateInRange(generator, 0, keyCount - 1)));
+			Bench::doNotOptimizeAway(it == unorderedMap.end() ? 0 : it->second.a);
+		});
+		bench.run("FlatHashMap hit", [&] {
+			Junk const* found = flatMap.Find(HashMapKey(GenerateInRange(generator, 0, keyCount - 1)));
+			Bench::doNotOptimizeAway(found ? found->a : 0);
+		});
+
+		bench.run("std::unordered_map miss", [&] {
+			Bench::doNotOptimizeAway(unorderedMap.find(HashMapKey(GenerateInRange(generator, keyCount, 2 * keyCount))) == unorderedMap.end());
+		});
+		bench.run("FlatHashMap miss", [&] {
+			Bench::doNotOptimizeAway(flatMap.Find(HashMapKey(GenerateInRange(generator, keyCount, 2 * keyCount))) == nullptr);
+		});
+
+		// Insert a key that is not present then erase it again, so the size stays put across epochs
+		bench.run("std::unordered_map insert erase", [&] {
+			uint32_t key = HashMapKey(GenerateInRange(generator, keyCount, 2 * keyCount));
+			unorderedMap.emplace(key, Junk{});
+			Bench::doNotOptimizeAway(unorderedMap.erase(key));
+		});
+		bench.run("FlatHashMap insert erase", [&] {
+			uint32_t key = HashMapKey(GenerateInRange(generator, keyCount, 2 * keyCount));
+			flatMap.Insert(key, Junk{});
+			Bench::doNotOptimizeAway(flatMap.Erase(key));
+		});
+	}
+}
+
+struct kvp
+{
+	uint32_t key;
+	std::shared_ptr<uint32_t> pData;
+};
+
+using kvp_soa = SoaVector<kvp>;
+
+bool Search(kvp* data, uint32_t target)
+{
+	for (uint32_t i = 0; i < k_arraySize; i++)
+	{
+		if (data[i].key == target) return true;
+	}
+
+	return false;
+}
+
+TEST(StructureOfArrays, ArrayOfStructsPointer)
+{
+	std::vector<kvp> kvs;
+	kvs.resize(k_arraySize);
+	for (int i = 0; i < k_arraySize; i++)
+	{
+		kvs[i].key = i;
+		kvs[i].pData = std::make_shared<uint32_t>(i);
+	}
+
+	std::mt19937 generator(k_randomSeed);
+
+	Bench::Bench().minEpochIterations(1000).run("ArrayOfStructs", [&] {
+		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
+		Bench::doNotOptimizeAway(Search(kvs.data(), target));
+	});
+}
+
+TEST(StructureOfArrays, StructureOfArraysPointer)
+{
+	kvp_soa kvs;
+	kvs.Resize(k_arraySize);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+	std::span<std::shared_ptr<uint32_t>> payloads = kvs.Column<k_valueColumn>();
+	for (int i = 0; i < k_arraySize; i++)
+	{
+		keys[i] = i;
+		payloads[i] = std::make_shared<uint32_t>(i);
+	}
+
+	std::mt19937 generator(k_randomSeed);
+	Bench::Bench().minEpochIterations(1000).run("StructOfArrays", [&] {
+		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
+		Bench::doNotOptimizeAway(Search(keys.data(), target));
+	});
+}
+
+// Lookups that arrive in batches, reading the payload behind each key. Payloads are allocated in shuffled key order so
+// neighbouring keys do not share cache lines, which leaves two dependent misses per lookup after the key is found:
+// the shared_ptr slot and the value it points to. One at a time, every lookup waits on its own misses. Batched, the binary
+// searches advance in lock step and the payload reads are staged, so the misses of a whole group are in flight together.
+// The linear Search baseline only runs at k_arraySize, the size it is written for.
+constexpr uint32_t k_batchLookupSizes[] = { k_arraySize, 4'000'000 };
+constexpr uint32_t k_lookupBatchSizes[] = { 1, 8, 32, 256, 1024 };
+
+TEST(StructureOfArrays, BatchedLookup)
+{
+	for (uint32_t keyCount : k_batchLookupSizes)
+	{
+		kvp_soa kvs;
+		kvs.Resize(keyCount);
+		std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+		std::span<std::shared_ptr<uint32_t>> payloads = kvs.Column<k_valueColumn>();
+		std::vector<uint32_t> allocationOrder(keyCount);
+		for (uint32_t i = 0; i < keyCount; i++)
+		{
+			keys[i] = i;
+			allocationOrder[i] = i;
+		}
+
+		std::mt19937 generator(k_randomSeed);
+		std::shuffle(allocationOrder.begin(), allocationOrder.end(), generator);
+		for (uint32_t i : allocationOrder)
+		{
+			payloads[i] = std::make_shared<uint32_t>(i);
+		}
+
+		KeySearch::SortedKeyIndex index(keys);
+		std::span<std::shared_ptr<uint32_t> const> constPayloads = payloads;
+
+		// The batched path has to agree with one lookup at a time, misses included
+		{
+			std::vector<uint32_t> targets(1000);
+			std::vector<size_t> positions(targets.size());
+			for (uint32_t& target : targets)
+			{
+				target = GenerateInRange(generator, 0, keyCount + keyCount / 10);
+			}
+
+			index.FindBatch(targets, positions);
+			uint32_t found = 0;
+			KeySearch::ForEachPointee(constPayloads, std::span<size_t const>(positions), [&](size_t i, uint32_t payload) {
+				ASSERT_EQ(payload, targets[i]);
+				++found;
+			});
+
+			for (size_t i = 0; i < targets.size(); i++)
+			{
+				ASSERT_EQ(positions[i], index.Find(targets[i]));
+				found -= positions[i] != KeySearch::k_notFound;
+			}
+
+			ASSERT_EQ(found, 0u);
+		}
+
+		for (uint32_t batchSize : k_lookupBatchSizes)
+		{
+			std::vector<uint32_t> targets(batchSize);
+			std::vector<size_t> positions(batchSize);
+			auto nextBatch = [&] {
+				for (uint32_t& target : targets)
+				{
+					target = GenerateInRange(generator, 0, keyCount - 1);
+				}
+			};
+
+			Bench::Bench bench;
+			bench.title("Batched lookup " + std::to_string(keyCount) + " keys, batch " + std::to_string(batchSize))
+				.unit("lookup").batch(batchSize).relative(true).minEpochIterations(keyCount == k_arraySize ? 10 : 100);
+
+			if (keyCount == k_arraySize)
+			{
+				bench.run("Search one at a time", [&] {
+					nextBatch();
+					uint32_t hits = 0;
+					for (uint32_t target : targets)
+					{
+						hits += Search(keys.data(), target);
+					}
+
+					Bench::doNotOptimizeAway(hits);
+				});
+			}
+
+			bench.run("Binary search one at a time", [&] {
+				nextBatch();
+				uint64_t sum = 0;
+				for (uint32_t target : targets)
+				{
+					size_t position = index.Find(target);
+					if (position != KeySearch::k_notFound) sum += *payloads[position];
+				}
+
+				Bench::doNotOptimizeAway(sum);
+			});
+			bench.run("Binary search batched", [&] {
+				nextBatch();
+				uint64_t sum = 0;
+				index.FindBatch(targets, positions);
+				KeySearch::ForEachPointee(constPayloads, std::span<size_t const>(positions), [&](size_t, uint32_t payload) { sum += payload; });
+				Bench::doNotOptimizeAway(sum);
+			});
+		}
+	}
+}
+
+// The same lookups as coroutines that suspend before every dependent load, with K kept in flight by a round robin scheduler.
+// Keys are shuffled and there are enough of them that the index, the payload slots and the payloads all miss in cache.
+// One at a time pays every miss in turn, group prefetching and coroutines overlap them, coroutines at the cost of a resume
+// per probe. Frames come from a per thread pool, so none of the lookups allocate from the heap.
+constexpr uint32_t k_coroutineLookupKeys = 4'000'000;
+constexpr uint32_t k_coroutineLookupBatch = 1024;
+constexpr uint32_t k_lookupsInFlight[] = { 1, 4, 8, 16, 32 };
+
+TEST(StructureOfArrays, CoroutineLookup)
+{
+	kvp_soa kvs;
+	kvs.Resize(k_coroutineLookupKeys);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+	std::span<std::shared_ptr<uint32_t>> payloads = kvs.Column<k_valueColumn>();
+	std::vector<uint32_t> order(k_coroutineLookupKeys);
+	for (uint32_t i = 0; i < k_coroutineLookupKeys; i++)
+	{
+		order[i] = i;
+	}
+
+	std::mt19937 generator(k_randomSeed);
+	std::shuffle(order.begin(), order.end(), generator);
+	for (uint32_t i = 0; i < k_coroutineLookupKeys; i++)
+	{
+		keys[i] = HashMapKey(order[i]);
+	}
+
+	std::shuffle(order.begin(), order.end(), generator);
+	for (uint32_t i : order)
+	{
+		payloads[i] = std::make_shared<uint32_t>(keys[i]);
+	}
+
+	KeySearch::SortedKeyIndex index(keys);
+	std::span<std::shared_ptr<uint32_t> const> constPayloads = payloads;
+
+	std::vector<uint32_t> targets(k_coroutineLookupBatch);
+	std::vector<size_t> positions(k_coroutineLookupBatch);
+	auto nextBatch = [&] {
+		for (uint32_t& target : targets)
+		{
+			target = HashMapKey(GenerateInRange(generator, 0, k_coroutineLookupKeys - 1));
+		}
+	};
+
+	// Interleaved results have to match Find, misses included
+	nextBatch();
+	targets[0] = HashMapKey(k_coroutineLookupKeys);
+	KeySearch::RunInterleaved(targets.size(), 8,
+		[&](size_t i) { return KeySearch::FindCoroutine(index, targets[i]); },
+		[&](size_t i, size_t position) { ASSERT_EQ(position, index.Find(targets[i])); });
+	KeySearch::RunInterleaved(targets.size(), 8,
+		[&](size_t i) { return KeySearch::FindPointeeCoroutine(index, constPayloads, targets[i]); },
+		[&](size_t i, std::optional<uint32_t> const& payload) { ASSERT_EQ(payload.value_or(0), i == 0 ? 0 : targets[i]); });
+
+	Bench::Bench search;
+	search.title("Sorted key search " + std::to_string(k_coroutineLookupKeys) + " shuffled keys")
+		.unit("lookup").batch(k_coroutineLookupBatch).relative(true).minEpochIterations(100);
+	search.run("one at a time", [&] {
+		nextBatch();
+		size_t found = 0;
+		for (uint32_t target : targets)
+		{
+			found += index.Find(target) != KeySearch::k_notFound;
+		}
+
+		Bench::doNotOptimizeAway(found);
+	});
+	search.run("group prefetching", [&] {
+		nextBatch();
+		index.FindBatch(targets, positions);
+		Bench::doNotOptimizeAway(positions.data());
+	});
+	for (uint32_t inFlight : k_lookupsInFlight)
+	{
+		search.run("coroutines " + std::to_string(inFlight) + " in flight", [&] {
+			nextBatch();
+			size_t found = 0;
+			KeySearch::RunInterleaved(targets.size(), inFlight,
+				[&](size_t i) { return KeySearch::FindCoroutine(index, targets[i]); },
+				[&](size_t, size_t position) { found += position != KeySearch::k_notFound; });
+			Bench::doNotOptimizeAway(found);
+		});
+	}
+
+	Bench::Bench payload;
+	payload.title("Payload lookup " + std::to_string(k_coroutineLookupKeys) + " shuffled keys")
+		.unit("lookup").batch(k_coroutineLookupBatch).relative(true).minEpochIterations(100);
+	payload.run("one at a time", [&] {
+		nextBatch();
+		uint64_t sum = 0;
+		for (uint32_t target : targets)
+		{
+			size_t position = index.Find(target);
+			if (position != KeySearch::k_notFound) sum += *payloads[position];
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	payload.run("group prefetching", [&] {
+		nextBatch();
+		uint64_t sum = 0;
+		index.FindBatch(targets, positions);
+		KeySearch::ForEachPointee(constPayloads, std::span<size_t const>(positions), [&](size_t, uint32_t value) { sum += value; });
+		Bench::doNotOptimizeAway(sum);
+	});
+	for (uint32_t inFlight : k_lookupsInFlight)
+	{
+		payload.run("coroutines " + std::to_string(inFlight) + " in flight", [&] {
+			nextBatch();
+			uint64_t sum = 0;
+			KeySearch::RunInterleaved(targets.size(), inFlight,
+				[&](size_t i) { return KeySearch::FindPointeeCoroutine(index, constPayloads, targets[i]); },
+				[&](size_t, std::optional<uint32_t> const& value) { sum += value.value_or(0); });
+			Bench::doNotOptimizeAway(sum);
+		});
+	}
+}
+
+// The pointer examples again with the payloads in a slot map. A handle is 4 bytes instead of a 16 byte shared_ptr, so the AoS
+// search drags less through the cache, and the payloads sit in one dense array instead of 100k separate control blocks
+using PayloadMap = SlotMap<uint32_t>;
+
+struct kvh
+{
+	uint32_t key;
+	PayloadMap::Handle handle;
+};
+
+using kvh_soa = SoaVector<kvh>;
+
+TEST(StructureOfArrays, SlotMapCorrectness)
+{
+	PayloadMap payloads;
+	PayloadMap::Handle first = payloads.Insert(1);
+	PayloadMap::Handle second = payloads.Insert(2);
+	PayloadMap::Handle third = payloads.Insert(3);
+
+	// Erasing the first value moves the last one into its place, handles to it stay valid
+	ASSERT_TRUE(payloads.Erase(first));
+	ASSERT_EQ(payloads.Get(first), nullptr);
+	ASSERT_EQ(*payloads.Get(second), 2u);
+	ASSERT_EQ(*payloads.Get(third), 3u);
+	ASSERT_EQ(payloads.Values()[0], 3u);
+
+	// The freed slot is reused with a new generation, so the stale handle still misses
+	PayloadMap::Handle fourth = payloads.Insert(4);
+	ASSERT_EQ(fourth.Index(), first.Index());
+	ASSERT_NE(fourth, first);
+	ASSERT_EQ(payloads.Get(first), nullptr);
+	ASSERT_FALSE(payloads.Erase(first));
+	ASSERT_EQ(*payloads.Get(fourth), 4u);
+	ASSERT_EQ(payloads.Size(), 3u);
+	ASSERT_EQ(payloads.Get(PayloadMap::k_invalidHandle), nullptr);
+}
+
+TEST(StructureOfArrays, SlotMapPointer)
+{
+	std::vector<kvp> kvps(k_arraySize);
+	kvp_soa kvpSoa;
+	kvpSoa.Reserve(k_arraySize);
+	PayloadMap payloads;
+	payloads.Reserve(k_arraySize);
+	std::vector<kvh> kvhs(k_arraySize);
+	kvh_soa kvhSoa;
+	kvhSoa.Reserve(k_arraySize);
+	for (uint32_t i = 0; i < k_arraySize; i++)
+	{
+		kvps[i] = { i, std::make_shared<uint32_t>(i) };
+		kvpSoa.PushBack(kvps[i]);
+
+		kvhs[i] = { i, payloads.Insert(i) };
+		kvhSoa.PushBack(kvhs[i]);
+	}
+
+	std::span<uint32_t> kvpKeys = kvpSoa.Column<k_keyColumn>();
+	std::span<std::shared_ptr<uint32_t>> kvpPayloads = kvpSoa.Column<k_valueColumn>();
+	std::span<uint32_t> kvhKeys = kvhSoa.Column<k_keyColumn>();
+	std::span<PayloadMap::Handle> kvhHandles = kvhSoa.Column<k_valueColumn>();
+
+	// Find the key and read its payload
+	std::mt19937 generator(k_randomSeed);
+	Bench::Bench search;
+	search.title("Pointer payload search").relative(true).minEpochIterations(1000);
+	search.run("ArrayOfStructs shared_ptr", [&] {
+		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
+		for (kvp const& entry : kvps)
+		{
+			if (entry.key == target)
+			{
+				Bench::doNotOptimizeAway(*entry.pData);
+				break;
+			}
+		}
+	});
+	search.run("ArrayOfStructs handle", [&] {
+		uint32_t target = GenerateInRange(generator, 0, k_arraySize - 1);
+		for (kvh const& entry : kvhs)
+		{
+			if (entry.key == target)
+			{
+				Bench::doNotOptimizeAway(*payloads.Get(entry.handle));
+				break;
+			}
+		}
+	});
+	search.run("StructOfArrays shared_ptr", [&] {
+		size_t index = KeySearch::FindKey(kvpKeys.data(), k_arraySize, GenerateInRange(generator, 0, k_arraySize - 1));
+		Bench::doNotOptimizeAway(*kvpPayloads[index]);
+	});
+	search.run("StructOfArrays handle", [&] {
+		size_t index = KeySearch::FindKey(kvhKeys.data(), k_arraySize, GenerateInRange(generator, 0, k_arraySize - 1));
+		Bench::doNotOptimizeAway(*payloads.Get(kvhHandles[index]));
+	});
+
+	// Read every payload, through the references or straight from the dense values
+	Bench::Bench sweep;
+	sweep.title("Pointer payload sweep").relative(true).minEpochIterations(10);
+	sweep.run("shared_ptr", [&] {
+		uint64_t sum = 0;
+		for (std::shared_ptr<uint32_t> const& payload : kvpPayloads)
+		{
+			sum += *payload;
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	sweep.run("handle", [&] {
+		uint64_t sum = 0;
+		for (PayloadMap::Handle handle : kvhHandles)
+		{
+			sum += *payloads.Get(handle);
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+	sweep.run("dense", [&] {
+		uint64_t sum = 0;
+		for (uint32_t payload : payloads)
+		{
+			sum += payload;
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Persistent tables
+// Loading a table by copying it out of a file costs a pass over every byte before the first query can run. Mapping a
+// column file makes opening it O(1) instead, and only the columns a query touches are ever read from disk
+
+constexpr size_t k_persistentTableRows = 4 * 1024 * 1024;
+
+// Same field count as kv but a different value type, so opening a kv file as one of these must fail
+struct kvNarrow
+{
+	uint32_t key;
+	uint64_t value;
+};
+
+std::string GetColumnFilePath(char const* name)
+{
+	return (std::filesystem::temp_directory_path() / name).string();
+}
+
+kv_soa MakePersistentTable(size_t rows)
+{
+	kv_soa kvs;
+	kvs.Resize(rows);
+	std::span<uint32_t> keys = kvs.Column<k_keyColumn>();
+	std::span<Junk> values = kvs.Column<k_valueColumn>();
+	for (size_t i = 0; i < rows; i++)
+	{
+		keys[i] = (uint32_t)i;
+		values[i] = { i, i * 2, i * 3, i * 4 };
+	}
+
+	return kvs;
+}
+
+// Drops the file from the page cache so the next open has to read it from disk. Only clean pages that nothing has mapped
+// can be dropped, and file systems without a backing device (tmpfs) keep them regardless. Windows has no per file
+// equivalent, so there every open after the first is warm
+void EvictFromPageCache(char const* path)
+{
+#if !_WIN32
+	int file = open(path, O_RDONLY);
+	if (file < 0) return;
+
+	fdatasync(file);
+	posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+	close(file);
+#endif
+}
+
+TEST(PersistentTables, roundTrip)
+{
+	kv_soa kvs = MakePersistentTable(1000);
+	std::string path = GetColumnFilePath("round_trip.soa");
+	ASSERT_TRUE(ColumnFile::Write(path.c_str(), kvs));
+
+	{
+		ColumnFile::MappedTable<kv> table(path.c_str());
+		ASSERT_TRUE(table.IsOpen()) << table.GetError();
+		ASSERT_EQ(table.Size(), kvs.Size());
+		EXPECT_TRUE(table.VerifyChecksum());
+		EXPECT_EQ((uintptr_t)table.Column<k_valueColumn>().data() % ColumnFile::k_columnAlignment, 0u);
+		EXPECT_TRUE(std::ranges::equal(table.Column<k_keyColumn>(), kvs.Column<k_keyColumn>()));
+		EXPECT_EQ(table.Column<k_valueColumn>()[999].d, kvs.Column<k_valueColumn>()[999].d);
+	}
+
+	kv_soa copy;
+	ASSERT_TRUE(ColumnFile::Read(path.c_str(), copy));
+	ASSERT_EQ(copy.Size(), kvs.Size());
+	EXPECT_TRUE(std::ranges::equal(copy.Column<k_keyColumn>(), kvs.Column<k_keyColumn>()));
+	EXPECT_EQ(copy.Column<k_valueColumn>()[500].c, kvs.Column<k_valueColumn>()[500].c);
+
+	std::filesystem::remove(path);
+}
+
+TEST(PersistentTables, rejectsBadFiles)
+{
+	std::string path = GetColumnFilePath("bad_file.soa");
+	ASSERT_TRUE(ColumnFile::Write(path.c_str(), MakePersistentTable(1000)));
+
+	std::vector<char> original(std::filesystem::file_size(path));
+	std::ifstream(path, std::ios::binary).read(original.data(), (std::streamsize)original.size());
+
+	std::string corruptPath = GetColumnFilePath("bad_file_corrupt.soa");
+	auto writeCorrupted = [&](size_t size, auto const& corrupt) {
+		std::vector<char> bytes(original.begin(), original.begin() + size);
+		corrupt(bytes);
+		std::ofstream(corruptPath, std::ios::binary | std::ios::trunc).write(bytes.data(), (std::streamsize)bytes.size());
+		return corruptPath.c_str();
+	};
+
+	{
+		ColumnFile::MappedTable<kvNarrow> table(path.c_str());
+		EXPECT_FALSE(table.IsOpen());
+		EXPECT_STREQ(table.GetError(), "Column element size does not match the table type");
+	}
+	{
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size(), [](std::vector<char>& bytes) { bytes[0] = 'X'; }));
+		EXPECT_STREQ(table.GetError(), "Not a column file");
+	}
+	{
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size(), [](std::vector<char>& bytes) { ++((ColumnFile::Header*)bytes.data())->version; }));
+		EXPECT_STREQ(table.GetError(), "Unsupported column file version");
+	}
+	{
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size(), [](std::vector<char>& bytes) { ++((ColumnFile::Header*)bytes.data())->rowCount; }));
+		EXPECT_STREQ(table.GetError(), "Header checksum mismatch");
+	}
+	{
+		// A forged row count whose byte size wraps around to the real one, with a valid header checksum
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size(), [](std::vector<char>& bytes) {
+			ColumnFile::Header& header = *(ColumnFile::Header*)bytes.data();
+			header.rowCount += 1ull << 62;
+			header.headerChecksum = ColumnFile::HeaderChecksum(header);
+		}));
+		EXPECT_STREQ(table.GetError(), "Column size does not match the row count");
+	}
+	{
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size() - 1, [](std::vector<char>&) {}));
+		EXPECT_STREQ(table.GetError(), "Column runs past the end of the file");
+	}
+	{
+		// Damage in a column is only found by the optional full check, opening stays O(1)
+		ColumnFile::MappedTable<kv> table(writeCorrupted(original.size(), [](std::vector<char>& bytes) { bytes.back() ^= 1; }));
+		ASSERT_TRUE(table.IsOpen()) << table.GetError();
+		EXPECT_FALSE(table.VerifyChecksum());
+	}
+
+	kv_soa copy;
+	EXPECT_FALSE(ColumnFile::Read(writeCorrupted(sizeof(ColumnFile::Header) - 1, [](std::vector<char>&) {}), copy));
+
+	std::filesystem::remove(path);
+	std::filesystem::remove(corruptPath);
+}
+
+// Time from nothing in memory to an answer, with the file evicted from the page cache before every test. Every variant
+// reports the whole table's size as its bytes, so the gb/s figures compare how quickly the table becomes usable
+TEST(PersistentTables, coldStart)
+{
+	std::string path = GetColumnFilePath("cold_start.soa");
+	ASSERT_TRUE(ColumnFile::Write(path.c_str(), MakePersistentTable(k_persistentTableRows)));
+	uint64_t tableBytes = std::filesystem::file_size(path);
+	uint32_t threshold = (uint32_t)(k_persistentTableRows / 2);
+
+	auto coldStartTest = [&](std::string const& testName, auto const& load) {
+		TestParameters params{
+			.expectedBytesToProcessPerTest = tableBytes,
+			.testName = "Cold start " + testName,
+			.numSecondsToFindNewResult = 1
+		};
+
+		RepetitionTester tester(params);
+
+		while (tester.IsTesting())
+		{
+			EvictFromPageCache(path.c_str());
+
+			tester.BeginTest();
+			Bench::doNotOptimizeAway(load());
+			tester.EndTest(tableBytes);
+		}
+
+		tester.PrintResults();
+	};
+
+	// Rebuild and read both end with the same key scan, so they compare like for like with map + key scan
+	coldStartTest("rebuild", [&] {
+		kv_soa kvs = MakePersistentTable(k_persistentTableRows);
+		return PredicateCount::CountGreaterThan(kvs.Column<k_keyColumn>().data(), kvs.Size(), threshold);
+	});
+	coldStartTest("read", [&] {
+		kv_soa kvs;
+		ColumnFile::Read(path.c_str(), kvs);
+		return PredicateCount::CountGreaterThan(kvs.Column<k_keyColumn>().data(), kvs.Size(), threshold);
+	});
+	coldStartTest("map", [&] {
+		ColumnFile::MappedTable<kv> table(path.c_str());
+		return table.Size();
+	});
+	coldStartTest("map + key scan", [&] {
+		ColumnFile::MappedTable<kv> table(path.c_str());
+		return PredicateCount::CountGreaterThan(table.Column<k_keyColumn>().data(), table.Size(), threshold);
+	});
+	coldStartTest("map + verify", [&] {
+		ColumnFile::MappedTable<kv> table(path.c_str());
+		return table.VerifyChecksum();
+	});
+
+	std::filesystem::remove(path);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Streaming scans
+// A key column larger than RAM cannot be searched in memory. Streaming it through a few chunk buffers keeps memory use
+// fixed, and reading the next chunk while comparing the current one hides whichever of the two is faster
+
+// Set PERF_SCAN_FILE_BYTES above the machine's RAM to measure a scan that cannot be served from the page cache
+uint64_t GetScanFileBytes()
+{
+	uint64_t fileBytes = k_gb;
+	if (char const* bytes = std::getenv("PERF_SCAN_FILE_BYTES"))
+	{
+		fileBytes = std::max<uint64_t>(std::strtoull(bytes, nullptr, 10), StreamingScan::k_directIoAlignment);
+	}
+
+	return fileBytes / sizeof(uint32_t) * sizeof(uint32_t);
+}
+
+// Keys 0, 1, 2... written a block at a time, so the file can be larger than RAM
+bool WriteKeyFile(char const* path, uint64_t keyCount)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	std::vector<uint32_t> block(1024 * 1024);
+	for (uint64_t written = 0; written < keyCount && file; written += block.size())
+	{
+		size_t count = (size_t)std::min<uint64_t>(block.size(), keyCount - written);
+		for (size_t i = 0; i < count; i++)
+		{
+			block[i] = (uint32_t)(written + i);
+		}
+
+		file.write((char const*)block.data(), (std::streamsize)(count * sizeof(uint32_t)));
+	}
+
+	return (bool)file;
+}
+
+size_t StreamingCountGreaterThan(StreamingScan::FileScanner& scanner, uint64_t keyCount, uint32_t threshold)
+{
+	ProfileScopeThroughput(keyCount * sizeof(uint32_t));
+
+	size_t total = 0;
+	scanner.ScanElements<uint32_t>(0, keyCount, [&](std::span<uint32_t const> keys) {
+		ProfileLabelledScopeThroughput("Streaming compare", keys.size_bytes());
+		total += PredicateCount::CountGreaterThan(keys.data(), keys.size(), threshold);
+		return true;
+	});
+
+	return total;
+}
+
+// Stops reading as soon as a chunk holds the key
+size_t StreamingFindKey(StreamingScan::FileScanner& scanner, uint64_t firstKey, uint64_t keyCount, uint32_t target)
+{
+	size_t index = KeySearch::k_notFound;
+	size_t chunkStart = 0;
+	scanner.ScanElements<uint32_t>(firstKey * sizeof(uint32_t), keyCount, [&](std::span<uint32_t const> keys) {
+		size_t found = KeySearch::FindKey(keys.data(), keys.size(), target);
+		if (found != KeySearch::k_notFound) index = chunkStart + found;
+		chunkStart += keys.size();
+		return index == KeySearch::k_notFound;
+	});
+
+	return index;
+}
+
+TEST(StreamingScan, correctness)
+{
+	// Not a whole number of pages, so the last direct read runs past the end of the file
+	constexpr uint64_t k_keyCount = 1'000'003;
+	std::string path = GetColumnFilePath("streaming_scan_keys.bin");
+	ASSERT_TRUE(WriteKeyFile(path.c_str(), k_keyCount));
+
+	for (uint32_t bufferCount : { 1u, 2u, 3u })
+	{
+		StreamingScan::FileScanner scanner(path.c_str(), 64 * 1024, bufferCount);
+		ASSERT_TRUE(scanner.IsOpen()) << scanner.GetError();
+
+		EXPECT_EQ(StreamingCountGreaterThan(scanner, k_keyCount, 1000), k_keyCount - 1001);
+		EXPECT_EQ(scanner.GetLastScanStats().bytesScanned, k_keyCount * sizeof(uint32_t));
+		EXPECT_EQ(scanner.GetError(), nullptr);
+
+		EXPECT_EQ(StreamingFindKey(scanner, 0, k_keyCount, (uint32_t)k_keyCount - 1), k_keyCount - 1);
+		EXPECT_EQ(StreamingFindKey(scanner, 0, k_keyCount, (uint32_t)k_keyCount), KeySearch::k_notFound);
+
+		// The first hit ends the scan after one chunk
+		EXPECT_EQ(StreamingFindKey(scanner, 0, k_keyCount, 5), 5u);
+		EXPECT_EQ(scanner.GetLastScanStats().chunkCount, 1u);
+
+		// A range that starts and ends off a page boundary is trimmed back after the aligned reads
+		EXPECT_EQ(StreamingFindKey(scanner, 1001, 50'000, 1001), 0u);
+		EXPECT_EQ(StreamingFindKey(scanner, 1001, 50'000, 51'000), 49'999u);
+		EXPECT_EQ(StreamingFindKey(scanner, 1001, 50'000, 51'001), KeySearch::k_notFound);
+	}
+
+	StreamingScan::FileScanner missing(GetColumnFilePath("streaming_scan_missing.bin").c_str(), 64 * 1024);
+	EXPECT_FALSE(missing.IsOpen());
+
+	std::filesystem::remove(path);
+}
+
+// GB/s of a streaming count against chunk size, then against buffer count. Reads bypass the page cache when the file
+// system allows it, otherwise the file is evicted before every scan
+TEST(StreamingScan, chunkSizeSweep)
+{
+	uint64_t fileBytes = GetScanFileBytes();
+	uint64_t keyCount = fileBytes / sizeof(uint32_t);
+	std::string path = GetColumnFilePath("streaming_scan_sweep.bin");
+	ASSERT_TRUE(WriteKeyFile(path.c_str(), keyCount)) << "Unable to write " << FormatBytes(fileBytes) << ", set PERF_SCAN_FILE_BYTES lower";
+
+	auto scanTest = [&](size_t chunkBytes, uint32_t bufferCount) {
+		StreamingScan::FileScanner scanner(path.c_str(), chunkBytes, bufferCount);
+		ASSERT_TRUE(scanner.IsOpen()) << scanner.GetError();
+
+		TestParameters params{
+			.expectedBytesToProcessPerTest = fileBytes,
+			.testName = "Streaming scan " + FormatBytes(chunkBytes) + " x" + std::to_string(bufferCount),
+			.numSecondsToFindNewResult = 1,
+			.stopRule = TestStopRule::ConfidenceInterval,
+			.minSamplesToConverge = 5,
+			.maxSecondsToConverge = 10
+		};
+
+		RepetitionTester tester(params);
+		uint64_t readWaitCycles = 0;
+		uint64_t totalCycles = 0;
+
+		while (tester.IsTesting())
+		{
+			if (!scanner.IsDirect()) EvictFromPageCache(path.c_str());
+
+			tester.BeginTest();
+			Bench::doNotOptimizeAway(StreamingCountGreaterThan(scanner, keyCount, (uint32_t)(keyCount / 2)));
+			tester.EndTest(fileBytes);
+
+			readWaitCycles += scanner.GetLastScanStats().readWaitCycles;
+			totalCycles += scanner.GetLastScanStats().totalCycles;
+		}
+
+		TestSummary summary = tester.GetSummary();
+		std::cout << "\t" << FormatBytes(chunkBytes) << " x" << bufferCount << (scanner.IsDirect() ? " direct: " : " buffered: ")
+			<< ResultsExport::GigabytesPerSecond(fileBytes, (double)summary.minClockCycles) << "gb/s (min time) "
+			<< ResultsExport::GigabytesPerSecond(fileBytes, summary.stats.median) << "gb/s (median time) "
+			<< 100.0 * (double)readWaitCycles / (double)std::max<uint64_t>(totalCycles, 1) << "% waiting for reads\n";
+	};
+
+	std::cout << "Streaming scan of " << FormatBytes(fileBytes) << " by chunk size:\n";
+	for (size_t chunkBytes = 64 * 1024; chunkBytes <= 64 * 1024 * 1024; chunkBytes *= 4)
+	{
+		scanTest(chunkBytes, 3);
+	}
+
+	std::cout << "Streaming scan of " << FormatBytes(fileBytes) << " by buffer count:\n";
+	for (uint32_t bufferCount : { 1u, 2u, 4u })
+	{
+		scanTest(4 * 1024 * 1024, bufferCount);
+	}
+
+	std::filesystem::remove(path);
+	PrintProfilingResults;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//Hoisting Example
+//We want to help our compilers by explicitly hoisting out loop-invariants
+// we also want to reduce branch mis-predictions by arranging our data and processing in such a way that we minimise branches taken
+// and if we do have to have a low level branch then the data that we are branching on helps the branch predictor as much as possible
+// Ideally we remove branches in general and operate with masking operations
+
+constexpr uint32_t k_branchArraySize = 100'000;
+
+//low-level unsorted branch
+TEST(Hoisting, randomBranching)
+{
+	std::mt19937 generator(k_randomSeed);
+	uint32_t data[k_branchArraySize];
+
+	for (uint32_t i = 0; i < k_branchArraySize; i++)
 	{
 		data[i] = GenerateInRange(generator, 0, 10'000);
 	}
 
-	std::sort(data, data + k_branchArraySize);
+	Bench::Bench().minEpochIterations(1000).run("randomBranching", [&]
+	{
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < k_branchArraySize; i++)
+		{
+			if (data[i] > 5'000) sum++;
+		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+}
+
+//sorted branch
+TEST(Hoisting, sortedBranch)
+{
+	std::mt19937 generator(k_randomSeed);
+	uint32_t data[k_branchArraySize];
+
+	for (uint32_t i = 0; i < k_branchArraySize; i++)
+	{
+		data[i] = GenerateInRange(generator, 0, 10'000);
+	}
 
-	uint64_t sum = 0;
+	std::sort(data, data + k_branchArraySize);
 
 	Bench::Bench().minEpochIterations(1000).run("sortedBranching", [&]
 	{
+		uint64_t sum = 0;
 		for (uint32_t i = 0; i < k_branchArraySize; i++)
 		{
 			if (data[i] > 5'000) sum++;
 		}
+
+		Bench::doNotOptimizeAway(sum);
+	});
+}
+
+// The same count without the branch, so random data costs the same as sorted data
+void CountGreaterThanBench(char const* title, std::vector<uint32_t> const& data)
+{
+	auto countScalar = [&](size_t count, uint32_t threshold) {
+		size_t total = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (data[i] > threshold) total++;
+		}
+
+		return total;
+	};
+
+	// Every kernel is checked before it is timed, with tails shorter than each kernel's unrolled 32 or 64 values
+	std::vector<size_t> counts;
+	for (size_t tail : { 0u, 1u, 15u, 31u, 63u })
+	{
+		counts.push_back(tail);
+		counts.push_back((data.size() - 64) / 64 * 64 + tail);
+	}
+
+	Bench::Bench bench;
+	bench.title(title).relative(true).minEpochIterations(1000);
+	auto run = [&](char const* name, PredicateCount::CountGreaterThanFn countGreaterThan) {
+		for (size_t count : counts)
+		{
+			for (uint32_t threshold : { 0u, 5'000u, 10'000u, 0x8000'0000u })
+			{
+				ASSERT_EQ(countGreaterThan(data.data(), count, threshold), countScalar(count, threshold)) << name << " count " << count << " threshold " << threshold;
+			}
+		}
+
+		bench.run(name, [&] {
+			Bench::doNotOptimizeAway(countGreaterThan(data.data(), data.size(), 5'000));
+		});
+	};
+
+	run("branchless", &PredicateCount::CountGreaterThanBranchless);
+	if (CpuFeatures::Get().avx2 && CpuFeatures::Get().popcnt) run("AVX2", &PredicateCount::CountGreaterThanAvx2);
+	if (CpuFeatures::Get().avx512f && CpuFeatures::Get().popcnt) run("AVX-512", &PredicateCount::CountGreaterThanAvx512);
+	run("dispatched", &PredicateCount::CountGreaterThan);
+}
+
+TEST(Hoisting, countGreaterThanRandom)
+{
+	std::mt19937 generator(k_randomSeed);
+	std::vector<uint32_t> data(k_branchArraySize);
+	for (uint32_t& value : data)
+	{
+		value = GenerateInRange(generator, 0, 10'000);
+	}
+
+	CountGreaterThanBench("CountGreaterThan random", data);
+}
+
+TEST(Hoisting, countGreaterThanSorted)
+{
+	std::mt19937 generator(k_randomSeed);
+	std::vector<uint32_t> data(k_branchArraySize);
+	for (uint32_t& value : data)
+	{
+		value = GenerateInRange(generator, 0, 10'000);
+	}
+
+	std::sort(data.begin(), data.end());
+	CountGreaterThanBench("CountGreaterThan sorted", data);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Parallel scaling
+// The search and the predicate count split across a persistent thread pool, from one thread up to every core. Speedup is the
+// single thread time over the N thread time and efficiency is speedup / N. Both loops are memory bound once the data is out
+// of cache, so expect them to flatten out when the memory controllers saturate rather than at the core count
+
+constexpr size_t k_parallelArraySize = 32 * 1024 * 1024;
+
+std::vector<uint32_t> GetScalingThreadCounts(uint32_t maxThreads)
+{
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threadCount = 1; threadCount < maxThreads; threadCount *= 2)
+	{
+		threadCounts.push_back(threadCount);
+	}
+
+	threadCounts.push_back(maxThreads);
+	return threadCounts;
+}
+
+// Allocated without being touched and filled by the pool, so with first touch each chunk's pages land on the NUMA node
+// of the thread that scans it when every thread is used
+std::unique_ptr<uint32_t[]> AllocateParallelArray(ThreadPool& pool, uint32_t maxValue)
+{
+	std::unique_ptr<uint32_t[]> values(new uint32_t[k_parallelArraySize]);
+	pool.ParallelFor(k_parallelArraySize, pool.ThreadCount(), [&](size_t begin, size_t end, uint32_t) {
+		std::mt19937 generator(k_randomSeed + (uint32_t)begin);
+		for (size_t i = begin; i < end; i++)
+		{
+			values[i] = GenerateInRange(generator, 0, maxValue);
+		}
+	});
+
+	return values;
+}
+
+template<typename Fn>
+void ScalingTest(std::string const& name, ThreadPool& pool, Fn const& fn)
+{
+	uint64_t bytesPerTest = k_parallelArraySize * sizeof(uint32_t);
+	double singleThreadCycles = 0;
+
+	std::cout << name << " scaling:\n";
+	for (uint32_t threadCount : GetScalingThreadCounts(pool.ThreadCount()))
+	{
+		TestParameters params{
+			.expectedBytesToProcessPerTest = bytesPerTest,
+			.testName = name + " " + std::to_string(threadCount) + " threads",
+			.numSecondsToFindNewResult = 1
+		};
+
+		RepetitionTester tester(params);
+		while (tester.IsTesting())
+		{
+			tester.BeginTest();
+			Bench::doNotOptimizeAway(fn(threadCount));
+			tester.EndTest(bytesPerTest);
+		}
+
+		double cycles = (double)tester.GetSummary().minClockCycles;
+		if (threadCount == 1) singleThreadCycles = cycles;
+		double speedup = singleThreadCycles / cycles;
+		std::cout << "\t" << threadCount << " threads: " << ResultsExport::GigabytesPerSecond(bytesPerTest, cycles) << "gb/s, "
+			<< speedup << "x speedup, " << 100.0 * speedup / threadCount << "% efficiency\n";
+	}
+}
+
+TEST(ParallelScaling, findKey)
+{
+	ThreadPool& pool = ThreadPool::Get();
+	std::unique_ptr<uint32_t[]> keys = AllocateParallelArray(pool, UINT32_MAX - 1);
+	ASSERT_EQ(KeySearch::ParallelFindKey(keys.get(), k_parallelArraySize, keys[k_parallelArraySize - 5], pool.ThreadCount()),
+		KeySearch::FindKey(keys.get(), k_parallelArraySize, keys[k_parallelArraySize - 5]));
+
+	// The key is never present, so every thread scans its whole chunk
+	ScalingTest("ParallelFindKey", pool, [&](uint32_t threadCount) {
+		return KeySearch::ParallelFindKey(keys.get(), k_parallelArraySize, UINT32_MAX, threadCount, pool);
+	});
+}
+
+TEST(ParallelScaling, countGreaterThan)
+{
+	ThreadPool& pool = ThreadPool::Get();
+	std::unique_ptr<uint32_t[]> values = AllocateParallelArray(pool, 10'000);
+	ASSERT_EQ(PredicateCount::ParallelCountGreaterThan(values.get(), k_parallelArraySize, 5'000, pool.ThreadCount()),
+		PredicateCount::CountGreaterThan(values.get(), k_parallelArraySize, 5'000));
+
+	ScalingTest("ParallelCountGreaterThan", pool, [&](uint32_t threadCount) {
+		return PredicateCount::ParallelCountGreaterThan(values.get(), k_parallelArraySize, 5'000, threadCount, pool);
+	});
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Work stealing
+// Fork/join on the work stealing scheduler. A recursive Fibonacci spawns one task per call and does almost no work in it,
+// so its time per task is the scheduling overhead. Labelled tasks also go through the profiler, which shows what that costs
+
+uint64_t Fibonacci(TaskScheduler& scheduler, uint32_t n, char const* label)
+{
+	if (n < 2) return n;
+
+	uint64_t a = 0;
+	uint64_t b = 0;
+	scheduler.ForkJoin([&] { a = Fibonacci(scheduler, n - 1, label); }, [&] { b = Fibonacci(scheduler, n - 2, label); }, label);
+	return a + b;
+}
+
+uint64_t SerialFibonacci(uint32_t n)
+{
+	return n < 2 ? n : SerialFibonacci(n - 1) + SerialFibonacci(n - 2);
+}
+
+constexpr uint32_t k_fibonacciN = 20;
+constexpr uint64_t k_fibonacciTasks = 10'945; // one per call with n >= 2
+
+TEST(WorkStealing, correctness)
+{
+	TaskScheduler& scheduler = TaskScheduler::Get();
+	uint64_t result = 0;
+	scheduler.Run([&] { result = Fibonacci(scheduler, k_fibonacciN, nullptr); });
+	ASSERT_EQ(result, SerialFibonacci(k_fibonacciN));
+
+	// Every index visited exactly once, with ranges that do not divide evenly
+	std::vector<std::atomic<uint32_t>> visits(100'003);
+	scheduler.ParallelFor(0, visits.size(), 1'000, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			visits[i].fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	for (std::atomic<uint32_t> const& count : visits)
+	{
+		ASSERT_EQ(count.load(), 1u);
+	}
+}
+
+TEST(WorkStealing, spawnOverhead)
+{
+	TaskScheduler& scheduler = TaskScheduler::Get();
+	scheduler.ResetStats();
+
+	Bench::Bench bench;
+	bench.title("Task spawn overhead").unit("task").batch(k_fibonacciTasks).relative(true).minEpochIterations(10);
+	bench.run("serial calls", [&] {
+		Bench::doNotOptimizeAway(SerialFibonacci(k_fibonacciN));
+	});
+	bench.run("fork/join", [&] {
+		scheduler.Run([&] { Bench::doNotOptimizeAway(Fibonacci(scheduler, k_fibonacciN, nullptr)); });
+	});
+	bench.run("fork/join profiled", [&] {
+		scheduler.Run([&] { Bench::doNotOptimizeAway(Fibonacci(scheduler, k_fibonacciN, "Fibonacci")); });
+	});
+	bench.run("flat spawn", [&] {
+		scheduler.Run([&] {
+			TaskGroup group;
+			for (uint64_t i = 0; i < k_fibonacciTasks; i++)
+			{
+				scheduler.Spawn(group, [] {});
+			}
+
+			scheduler.Wait(group);
+		});
+	});
+
+	scheduler.PrintStats();
+}
+
+TEST(WorkStealing, parallelFor)
+{
+	TaskScheduler& scheduler = TaskScheduler::Get();
+	ThreadPool& pool = ThreadPool::Get();
+	std::unique_ptr<uint32_t[]> values = AllocateParallelArray(pool, 10'000);
+	size_t expected = PredicateCount::CountGreaterThan(values.get(), k_parallelArraySize, 5'000);
+
+	auto countWithScheduler = [&](size_t grainSize, char const* label) {
+		std::atomic<size_t> total = 0;
+		scheduler.ParallelFor(0, k_parallelArraySize, grainSize, [&](size_t begin, size_t end) {
+			total.fetch_add(PredicateCount::CountGreaterThan(values.get() + begin, end - begin, 5'000), std::memory_order_relaxed);
+		}, label);
+		return total.load();
+	};
+
+	ASSERT_EQ(countWithScheduler(1'000, nullptr), expected);
+
+	// Static chunks on the thread pool against stolen halves, small grains pay more in scheduling and atomics
+	Bench::Bench bench;
+	bench.title("ParallelFor count greater than").relative(true).minEpochIterations(10);
+	bench.run("ThreadPool", [&] {
+		Bench::doNotOptimizeAway(PredicateCount::ParallelCountGreaterThan(values.get(), k_parallelArraySize, 5'000, pool.ThreadCount(), pool));
 	});
+	for (size_t grainSize : { 1 << 12, 1 << 16, 1 << 20 })
+	{
+		bench.run("TaskScheduler grain " + std::to_string(grainSize), [&] {
+			Bench::doNotOptimizeAway(countWithScheduler(grainSize, nullptr));
+		});
+	}
+
+	// One profiled pass, to show per task latency next to the per worker steals and idle time
+	scheduler.ResetStats();
+	Bench::doNotOptimizeAway(countWithScheduler(1 << 16, "CountGreaterThan chunk"));
+	PrintProfilingResults;
+
+	// Timeline of the same pass for Perfetto or chrome://tracing, only written when built with PROFILER_TRACE
+	WriteProfilingTrace("work_stealing_trace.json");
+	scheduler.PrintStats();
 }
 
 constexpr uint32_t k_vectorSize = 10'000;
@@ -310,12 +2047,13 @@ TEST(Allocators, defaultAllocator)
 
 TEST(Allocators, poolAllocator)
 {
-	Bench::Bench().minEpochIterations(1000).run("Pool Allocator", [&] {
-		std::pmr::pool_options options;
-		options.max_blocks_per_chunk = 100; //Maximum number of blocks allocated at once when requesting a new chunk
-		options.largest_required_pool_block = sizeof(Junk);
-		std::pmr::unsynchronized_pool_resource memoryPool{ options };
+	// Built once outside the timed lambda, constructing it on every iteration measured pool setup rather than allocation
+	std::pmr::pool_options options;
+	options.max_blocks_per_chunk = 100; //Maximum number of blocks allocated at once when requesting a new chunk
+	options.largest_required_pool_block = sizeof(Junk);
+	std::pmr::unsynchronized_pool_resource memoryPool{ options };
 
+	Bench::Bench().minEpochIterations(1000).run("Pool Allocator", [&] {
 		//Initialize and destruct vector within scope
 		std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &memoryPool };
 		vector.resize(k_vectorSize);
@@ -324,13 +2062,263 @@ TEST(Allocators, poolAllocator)
 
 TEST(Allocators, monotonicAllocator)
 {
+	// With a caller owned buffer release() rewinds to its start instead of returning memory upstream
+	std::vector<std::byte> storage(k_vectorSize * sizeof(Junk));
+	std::pmr::monotonic_buffer_resource buffer{ storage.data(), storage.size() };
+
 	Bench::Bench().minEpochIterations(1000).run("Monotonic Allocator", [&] {
-		std::pmr::monotonic_buffer_resource buffer{ k_vectorSize * sizeof(Junk) };
-		std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &buffer };
-		vector.resize(k_vectorSize);
+		{
+			std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &buffer };
+			vector.resize(k_vectorSize);
+		}
+
+		buffer.release();
+	});
+}
+
+TEST(Allocators, arenaAllocator)
+{
+	ArenaResource arena{ k_vectorSize * sizeof(Junk) };
+
+	Bench::Bench().minEpochIterations(1000).run("Arena Allocator", [&] {
+		{
+			std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &arena };
+			vector.resize(k_vectorSize);
+		}
+
+		arena.Reset();
+	});
+}
+
+TEST(Allocators, frameAllocator)
+{
+	FrameResource frames{ k_vectorSize * sizeof(Junk) };
+
+	Bench::Bench().minEpochIterations(1000).run("Frame Allocator", [&] {
+		{
+			std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &frames };
+			vector.resize(k_vectorSize);
+		}
+
+		frames.NextFrame();
 	});
+}
+
+// One pass of the vector benchmarks in profile scopes, configure with PROFILER_TRACK_ALLOCATIONS to see each one's heap use
+TEST(Allocators, allocationTracking)
+{
+	std::pmr::unsynchronized_pool_resource memoryPool;
+	ArenaResource arena{ k_vectorSize * sizeof(Junk) };
+
+	{
+		ProfileLabelledScope("Default Allocator");
+		std::vector<Junk> vector;
+		vector.resize(k_vectorSize);
+	}
+
+	{
+		ProfileLabelledScope("Pool Allocator");
+		std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &memoryPool };
+		vector.resize(k_vectorSize);
+	}
+
+	{
+		ProfileLabelledScope("Arena Allocator");
+		{
+			std::vector<Junk, std::pmr::polymorphic_allocator<Junk>> vector{ &arena };
+			vector.resize(k_vectorSize);
+		}
+
+		arena.Reset();
+	}
+
+#if PROFILER_TRACK_ALLOCATIONS
+	// The default allocator makes exactly one allocation per pass, the arena never reaches the heap once it is built
+	for (Profiler::ProfileResult const& result : Profiler::ProfilerResultsHolder::Get().MergeResults(0))
+	{
+		std::string_view label = result.label;
+		if (label == "Default Allocator")
+		{
+			ASSERT_EQ(result.allocationCount, result.hitCount);
+			ASSERT_EQ(result.bytesAllocated, result.hitCount * k_vectorSize * sizeof(Junk));
+			ASSERT_EQ(result.peakLiveBytes, k_vectorSize * sizeof(Junk));
+		}
+		else if (label == "Arena Allocator")
+		{
+			ASSERT_EQ(result.allocationCount, 0u);
+			ASSERT_EQ(result.peakLiveBytes, 0u);
+		}
+	}
+#endif
+
+	PrintProfilingResults;
+}
+
+TEST(Allocators, memoryResourceCorrectness)
+{
+	// Overflowing the first block keeps earlier allocations intact, and Reset grows the arena to fit the whole pass
+	ArenaResource arena{ 256 };
+	std::vector<uint64_t*> values;
+	for (uint64_t i = 0; i < 100; ++i)
+	{
+		uint64_t* value = (uint64_t*)arena.allocate(sizeof(uint64_t), alignof(uint64_t));
+		*value = i;
+		values.push_back(value);
+	}
+
+	for (uint64_t i = 0; i < 100; ++i)
+	{
+		ASSERT_EQ(*values[i], i);
+	}
+
+	void* aligned = arena.allocate(1, 64);
+	ASSERT_EQ((uintptr_t)aligned % 64, 0u);
+	arena.Reset();
+	ASSERT_GE(arena.Capacity(), 100 * sizeof(uint64_t));
+
+	// Freed blocks are handed out again before the pool carves new ones, oversized requests bypass the pool
+	PoolResource pool{ sizeof(Junk) };
+	void* first = pool.allocate(sizeof(Junk), alignof(Junk));
+	pool.deallocate(first, sizeof(Junk), alignof(Junk));
+	ASSERT_EQ(pool.allocate(sizeof(Junk), alignof(Junk)), first);
+	void* large = pool.allocate(4096, 8);
+	pool.deallocate(large, 4096, 8);
+	pool.deallocate(first, sizeof(Junk), alignof(Junk));
+
+	// More pools in turn than the thread cache has entries for: evicted entries go back to their pool instead of being
+	// stranded, so each pool keeps reusing its first chunk
+	std::vector<std::unique_ptr<PoolResource>> pools;
+	for (uint32_t i = 0; i < 12; ++i)
+	{
+		pools.push_back(std::make_unique<PoolResource>(sizeof(Junk), 256));
+	}
+
+	std::vector<void*> blocks(100);
+	for (uint32_t round = 0; round < 100; ++round)
+	{
+		for (std::unique_ptr<PoolResource> const& rotatingPool : pools)
+		{
+			for (void*& block : blocks)
+			{
+				block = rotatingPool->allocate(sizeof(Junk), alignof(Junk));
+			}
+
+			for (void* block : blocks)
+			{
+				rotatingPool->deallocate(block, sizeof(Junk), alignof(Junk));
+			}
+		}
+	}
+
+	for (std::unique_ptr<PoolResource> const& rotatingPool : pools)
+	{
+		ASSERT_EQ(rotatingPool->ChunkCount(), 1u);
+	}
+
+	// Last frame's allocations survive one NextFrame call
+	FrameResource frames{ 1024 };
+	uint32_t* previous = (uint32_t*)frames.allocate(sizeof(uint32_t), alignof(uint32_t));
+	*previous = 42;
+	frames.NextFrame();
+	uint32_t* current = (uint32_t*)frames.allocate(sizeof(uint32_t), alignof(uint32_t));
+	*current = 7;
+	ASSERT_NE(previous, current);
+	ASSERT_EQ(*previous, 42u);
+}
+
+// Allocation sizes and the order blocks are freed in, generated once so every resource sees the same requests
+struct AllocationWorkload
+{
+	std::vector<uint32_t> sizes;
+	std::vector<uint32_t> freeOrder;
+	std::vector<void*> blocks;
+};
+
+constexpr uint32_t k_allocationCount = 10'000;
+
+AllocationWorkload MakeAllocationWorkload(uint32_t minSize, uint32_t maxSize)
+{
+	std::mt19937 generator(k_randomSeed);
+	AllocationWorkload workload;
+	workload.sizes.resize(k_allocationCount);
+	workload.freeOrder.resize(k_allocationCount);
+	workload.blocks.resize(k_allocationCount);
+	for (uint32_t i = 0; i < k_allocationCount; ++i)
+	{
+		workload.sizes[i] = GenerateInRange(generator, minSize, maxSize);
+		workload.freeOrder[i] = i;
+	}
 
+	std::shuffle(workload.freeOrder.begin(), workload.freeOrder.end(), generator);
+	return workload;
+}
+
+// Allocates every block and writes to it, then frees them all in a shuffled order
+void RunAllocationWorkload(std::pmr::memory_resource& resource, AllocationWorkload& workload)
+{
+	for (uint32_t i = 0; i < k_allocationCount; ++i)
+	{
+		workload.blocks[i] = resource.allocate(workload.sizes[i], alignof(std::max_align_t));
+		*(uint32_t*)workload.blocks[i] = i;
+	}
+
+	for (uint32_t i : workload.freeOrder)
+	{
+		resource.deallocate(workload.blocks[i], workload.sizes[i], alignof(std::max_align_t));
+	}
 }
 
+// Every resource is built before the bench runs, so each pass measures steady state allocation
+void AllocationWorkloadBench(std::string const& title, AllocationWorkload& workload, uint32_t maxSize)
+{
+	size_t totalBytes = 0;
+	for (uint32_t size : workload.sizes)
+	{
+		totalBytes += size + alignof(std::max_align_t);
+	}
+
+	std::pmr::unsynchronized_pool_resource standardPool;
+	std::vector<std::byte> monotonicStorage(totalBytes);
+	std::pmr::monotonic_buffer_resource monotonic{ monotonicStorage.data(), monotonicStorage.size() };
+	ArenaResource arena{ totalBytes };
+	FrameResource frames{ totalBytes };
+	PoolResource pool{ maxSize };
+
+	Bench::Bench bench;
+	bench.title(title).relative(true).minEpochIterations(100);
+	bench.run("new/delete", [&] {
+		RunAllocationWorkload(*std::pmr::new_delete_resource(), workload);
+	});
+	bench.run("std::pmr pool", [&] {
+		RunAllocationWorkload(standardPool, workload);
+	});
+	bench.run("std::pmr monotonic", [&] {
+		RunAllocationWorkload(monotonic, workload);
+		monotonic.release();
+	});
+	bench.run("Arena", [&] {
+		RunAllocationWorkload(arena, workload);
+		arena.Reset();
+	});
+	bench.run("Frame", [&] {
+		RunAllocationWorkload(frames, workload);
+		frames.NextFrame();
+	});
+	bench.run("Pool", [&] {
+		RunAllocationWorkload(pool, workload);
+	});
+}
 
+TEST(Allocators, smallObjects)
+{
+	AllocationWorkload workload = MakeAllocationWorkload(sizeof(Junk), sizeof(Junk));
+	AllocationWorkloadBench("Many small objects", workload, sizeof(Junk));
+}
 
+// The fixed size pool rounds every request up to the largest size, trading memory for a single free list
+TEST(Allocators, mixedSizes)
+{
+	constexpr uint32_t k_maxSize = 512;
+	AllocationWorkload workload = MakeAllocationWorkload(8, k_maxSize);
+	AllocationWorkloadBench("Mixed sizes", workload, k_maxSize);
+}
@@ -0,0 +1,226 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#include <emmintrin.h>
+
+// Open addressing hash map laid out like a Swiss table. Each slot has a one byte control entry: empty, deleted, or the low
+// 7 bits of the key's hash. Control bytes are probed 16 at a time with SSE2, so a lookup usually touches one 16 byte control
+// group and one key, and never follows a pointer. Keys and values live in their own arrays, so large values are only read on a hit.
+
+struct FlatHashMix
+{
+	// Integer hashes from std::hash are often the identity, mix the bits so the low 7 and the high bits are both useful
+	size_t operator()(uint64_t key) const
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+		return (size_t)key;
+	}
+};
+
+template<typename Key, typename Value, typename Hash = FlatHashMix>
+class FlatHashMap
+{
+public:
+	static constexpr size_t k_groupSize = 16;
+
+	explicit FlatHashMap(size_t initialCapacity = 0)
+	{
+		Allocate(CapacityFor(initialCapacity));
+	}
+
+	FlatHashMap(FlatHashMap const&) = delete;
+	FlatHashMap& operator=(FlatHashMap const&) = delete;
+
+	// Returns false and overwrites the value if the key was already present
+	bool Insert(Key const& key, Value const& value)
+	{
+		size_t hash = Hash{}(key);
+		if (size_t slot = FindSlot(key, hash); slot != k_noSlot)
+		{
+			values[slot] = value;
+			return false;
+		}
+
+		if (size + deletedCount + 1 > MaxLoad(capacity))
+		{
+			// Mostly tombstones, rehashing at the same size is enough to clear them
+			Rehash(size + 1 > MaxLoad(capacity) / 2 ? capacity * 2 : capacity);
+		}
+
+		InsertUnique(key, value, hash);
+		return true;
+	}
+
+	Value* Find(Key const& key)
+	{
+		size_t slot = FindSlot(key, Hash{}(key));
+		return slot == k_noSlot ? nullptr : &values[slot];
+	}
+
+	Value const* Find(Key const& key) const
+	{
+		size_t slot = FindSlot(key, Hash{}(key));
+		return slot == k_noSlot ? nullptr : &values[slot];
+	}
+
+	bool Contains(Key const& key) const { return FindSlot(key, Hash{}(key)) != k_noSlot; }
+
+	bool Erase(Key const& key)
+	{
+		size_t slot = FindSlot(key, Hash{}(key));
+		if (slot == k_noSlot) return false;
+
+		// A group that still has an empty slot has never been full, so no probe sequence continues past it and
+		// the slot can go straight back to empty. Otherwise leave a tombstone so later keys in the chain are still found
+		size_t group = slot / k_groupSize;
+		bool groupHasEmpty = MatchEmpty(LoadGroup(group)) != 0;
+		control[slot] = groupHasEmpty ? k_empty : k_deleted;
+		if (!groupHasEmpty) ++deletedCount;
+
+		keys[slot] = Key{};
+		values[slot] = Value{};
+		--size;
+		return true;
+	}
+
+	size_t Size() const { return size; }
+	size_t Capacity() const { return capacity; }
+
+private:
+	static constexpr int8_t k_empty = (int8_t)0x80;
+	static constexpr int8_t k_deleted = (int8_t)0xFE;
+	static constexpr size_t k_noSlot = SIZE_MAX;
+
+	struct ControlDeleter
+	{
+		void operator()(int8_t* data) const { ::operator delete[](data, std::align_val_t(k_groupSize)); }
+	};
+
+	// Keep at most 7/8 of slots in use, a 16 wide group probe stays fast well past the load factors linear probing can handle
+	static size_t MaxLoad(size_t slotCount) { return slotCount - slotCount / 8; }
+
+	static size_t CapacityFor(size_t count)
+	{
+		size_t slotCount = k_groupSize;
+		while (MaxLoad(slotCount) < count)
+		{
+			slotCount *= 2;
+		}
+
+		return slotCount;
+	}
+
+	// High bits pick the group, low 7 bits are stored in the control byte to filter keys before comparing them
+	size_t FirstGroup(size_t hash) const { return (hash >> 7) & (groupCount - 1); }
+	static int8_t ControlHash(size_t hash) { return (int8_t)(hash & 0x7F); }
+
+	__m128i LoadGroup(size_t group) const
+	{
+		return _mm_load_si128((__m128i const*)(control.get() + group * k_groupSize));
+	}
+
+	static uint32_t Match(__m128i group, int8_t controlHash)
+	{
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(controlHash)));
+	}
+
+	static uint32_t MatchEmpty(__m128i group)
+	{
+		return Match(group, k_empty);
+	}
+
+	// Empty and deleted both have the high bit set, so movemask alone finds them
+	static uint32_t MatchEmptyOrDeleted(__m128i group)
+	{
+		return (uint32_t)_mm_movemask_epi8(group);
+	}
+
+	size_t FindSlot(Key const& key, size_t hash) const
+	{
+		int8_t controlHash = ControlHash(hash);
+		size_t group = FirstGroup(hash);
+
+		// Triangular probing over a power of two group count visits every group exactly once
+		for (size_t probe = 1; probe <= groupCount; ++probe)
+		{
+			__m128i groupControl = LoadGroup(group);
+			for (uint32_t matches = Match(groupControl, controlHash); matches != 0; matches &= matches - 1)
+			{
+				size_t slot = group * k_groupSize + (size_t)std::countr_zero(matches);
+				if (keys[slot] == key) return slot;
+			}
+
+			if (MatchEmpty(groupControl) != 0) return k_noSlot;
+			group = (group + probe) & (groupCount - 1);
+		}
+
+		return k_noSlot;
+	}
+
+	void InsertUnique(Key const& key, Value const& value, size_t hash)
+	{
+		size_t group = FirstGroup(hash);
+		for (size_t probe = 1;; ++probe)
+		{
+			if (uint32_t available = MatchEmptyOrDeleted(LoadGroup(group)); available != 0)
+			{
+				size_t slot = group * k_groupSize + (size_t)std::countr_zero(available);
+				if (control[slot] == k_deleted) --deletedCount;
+
+				control[slot] = ControlHash(hash);
+				keys[slot] = key;
+				values[slot] = value;
+				++size;
+				return;
+			}
+
+			group = (group + probe) & (groupCount - 1);
+		}
+	}
+
+	void Allocate(size_t slotCount)
+	{
+		capacity = slotCount;
+		groupCount = slotCount / k_groupSize;
+		control = std::unique_ptr<int8_t[], ControlDeleter>(new (std::align_val_t(k_groupSize)) int8_t[slotCount]);
+		std::memset(control.get(), (uint8_t)k_empty, slotCount);
+		keys = std::make_unique<Key[]>(slotCount);
+		values = std::make_unique<Value[]>(slotCount);
+		size = 0;
+		deletedCount = 0;
+	}
+
+	void Rehash(size_t slotCount)
+	{
+		std::unique_ptr<int8_t[], ControlDeleter> oldControl = std::move(control);
+		std::unique_ptr<Key[]> oldKeys = std::move(keys);
+		std::unique_ptr<Value[]> oldValues = std::move(values);
+		size_t oldCapacity = capacity;
+
+		Allocate(slotCount);
+		for (size_t slot = 0; slot < oldCapacity; ++slot)
+		{
+			if (oldControl[slot] >= 0)
+			{
+				InsertUnique(oldKeys[slot], oldValues[slot], Hash{}(oldKeys[slot]));
+			}
+		}
+	}
+
+	std::unique_ptr<int8_t[], ControlDeleter> control;
+	std::unique_ptr<Key[]> keys;
+	std::unique_ptr<Value[]> values;
+	size_t capacity = 0;
+	size_t groupCount = 0;
+	size_t size = 0;
+	size_t deletedCount = 0;
+};
@@ -0,0 +1,210 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+
+//Reads hardware performance counters around a test, on Linux these come from a single perf_event_open group
+//so every counter is scheduled onto the PMU together and covers exactly the same instructions.
+//If the kernel denies access (perf_event_paranoid, containers, VMs without a virtual PMU) the counters are
+//dropped with a single message and everything else keeps working.
+
+#if !_WIN32
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+enum class HardwareCounter
+{
+	Instructions,
+	CoreCycles,
+	CacheReferences,
+	CacheMisses,
+	BranchInstructions,
+	BranchMisses,
+	L1DataReadMisses,
+	DataTlbReadMisses,
+};
+
+constexpr uint32_t k_MaxHardwareCounters = 8;
+
+inline char const* GetHardwareCounterName(HardwareCounter counter)
+{
+	switch (counter)
+	{
+	case HardwareCounter::Instructions: return "instructions";
+	case HardwareCounter::CoreCycles: return "core cycles";
+	case HardwareCounter::CacheReferences: return "cache refs";
+	case HardwareCounter::CacheMisses: return "cache misses";
+	case HardwareCounter::BranchInstructions: return "branches";
+	case HardwareCounter::BranchMisses: return "branch misses";
+	case HardwareCounter::L1DataReadMisses: return "L1d read misses";
+	case HardwareCounter::DataTlbReadMisses: return "dTLB read misses";
+	}
+
+	return "unknown";
+}
+
+struct HardwareCounterValues
+{
+	uint64_t values[k_MaxHardwareCounters] = {};
+	uint32_t count = 0;
+};
+
+class HardwareCounters
+{
+public:
+	explicit HardwareCounters(std::vector<HardwareCounter> const& requestedCounters)
+	{
+		if (requestedCounters.size() > k_MaxHardwareCounters)
+		{
+			std::cout << "Hardware counters: only the first " << k_MaxHardwareCounters << " requested counters will be read\n";
+		}
+
+		std::string skippedCounters;
+		for (HardwareCounter counter : requestedCounters)
+		{
+			if (counters.size() == k_MaxHardwareCounters) break;
+			if (!Open(counter))
+			{
+				skippedCounters += skippedCounters.empty() ? "" : ", ";
+				skippedCounters += GetHardwareCounterName(counter);
+			}
+		}
+
+		if (!skippedCounters.empty())
+		{
+			std::cout << "Hardware counters: skipping " << skippedCounters << " (" << openError << ")\n";
+		}
+	}
+
+	~HardwareCounters()
+	{
+#if !_WIN32
+		for (int fd : fileDescriptors)
+		{
+			close(fd);
+		}
+#endif
+	}
+
+	HardwareCounters(HardwareCounters const&) = delete;
+	HardwareCounters& operator=(HardwareCounters const&) = delete;
+
+	bool IsEnabled() const { return !counters.empty(); }
+	std::vector<HardwareCounter> const& GetCounters() const { return counters; }
+
+	void Start()
+	{
+#if !_WIN32
+		if (!IsEnabled()) return;
+		ioctl(fileDescriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fileDescriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	//Returns false if the group was never scheduled onto the PMU, in which case the values are meaningless
+	bool Stop(HardwareCounterValues& outValues)
+	{
+		outValues.count = 0;
+#if !_WIN32
+		if (!IsEnabled()) return false;
+		ioctl(fileDescriptors[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+		//Layout for PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING
+		uint64_t buffer[3 + k_MaxHardwareCounters] = {};
+		if (read(fileDescriptors[0], buffer, sizeof(buffer)) <= 0) return false;
+
+		uint64_t counterCount = buffer[0];
+		uint64_t timeEnabled = buffer[1];
+		uint64_t timeRunning = buffer[2];
+		if (timeRunning == 0)
+		{
+			// Opened but never counted: more counters than the PMU has free, one held by the NMI watchdog, or a VM without a vPMU
+			if (!reportedUnscheduled)
+			{
+				std::cout << "Hardware counters: group never scheduled on the PMU, request fewer counters\n";
+				reportedUnscheduled = true;
+			}
+
+			return false;
+		}
+
+		//Scale up if the group was multiplexed with other perf users for part of the test
+		double scale = (double)timeEnabled / (double)timeRunning;
+		for (uint64_t i = 0; i < counterCount && i < k_MaxHardwareCounters; ++i)
+		{
+			outValues.values[i] = timeEnabled == timeRunning ? buffer[3 + i] : (uint64_t)((double)buffer[3 + i] * scale);
+		}
+		outValues.count = (uint32_t)counterCount;
+
+		return true;
+#else
+		return false;
+#endif
+	}
+
+private:
+	bool Open(HardwareCounter counter)
+	{
+#if !_WIN32
+		perf_event_attr attributes{};
+		attributes.size = sizeof(attributes);
+		SetEventType(counter, attributes);
+		attributes.disabled = fileDescriptors.empty() ? 1 : 0; //Only the leader is toggled, members follow it
+		attributes.exclude_kernel = 1; //Allowed at the default perf_event_paranoid level
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int groupFd = fileDescriptors.empty() ? -1 : fileDescriptors[0];
+		int fd = (int)syscall(SYS_perf_event_open, &attributes, 0 /*this process*/, -1 /*any cpu*/, groupFd, 0);
+		if (fd == -1)
+		{
+			openError = std::strerror(errno);
+			return false;
+		}
+
+		fileDescriptors.push_back(fd);
+		counters.push_back(counter);
+		return true;
+#else
+		openError = "not supported on this platform";
+		return false;
+#endif
+	}
+
+#if !_WIN32
+	static void SetEventType(HardwareCounter counter, perf_event_attr& attributes)
+	{
+		auto cacheEvent = [](uint64_t cache, uint64_t op, uint64_t result) { return cache | (op << 8) | (result << 16); };
+
+		attributes.type = PERF_TYPE_HARDWARE;
+		switch (counter)
+		{
+		case HardwareCounter::Instructions: attributes.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case HardwareCounter::CoreCycles: attributes.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case HardwareCounter::CacheReferences: attributes.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+		case HardwareCounter::CacheMisses: attributes.config = PERF_COUNT_HW_CACHE_MISSES; break;
+		case HardwareCounter::BranchInstructions: attributes.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS; break;
+		case HardwareCounter::BranchMisses: attributes.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		case HardwareCounter::L1DataReadMisses:
+			attributes.type = PERF_TYPE_HW_CACHE;
+			attributes.config = cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+			break;
+		case HardwareCounter::DataTlbReadMisses:
+			attributes.type = PERF_TYPE_HW_CACHE;
+			attributes.config = cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+			break;
+		}
+	}
+
+	std::vector<int> fileDescriptors;
+#endif
+	std::vector<HardwareCounter> counters;
+	std::string openError;
+	bool reportedUnscheduled = false;
+};
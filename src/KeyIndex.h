@@ -0,0 +1,305 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <span>
+#include <vector>
+#include <immintrin.h>
+#include "KeySearch.h"
+
+// Indexes over a structure of arrays key column, for lookups that beat a linear scan once there are more than a few
+// hundred keys. Each is built once from the key column, keys do not need to be sorted, and Find returns the position
+// of the key in the original column (so it indexes the parallel value arrays) or k_notFound.
+// SortedKeyIndex: sorted keys with a branchless binary search, log2(n) dependent cache misses
+// EytzingerKeyIndex: keys in breadth first order so the next four levels of the search share a cache line that can be prefetched
+// STreeKeyIndex: static B-tree with one 16 key cache line per node, log17(n) dependent cache misses
+// Batches of lookups can hide most of those misses: SortedKeyIndex::FindBatch runs a group of binary searches in lock step,
+// and ForEachPointee reads the payloads the positions refer to in passes that prefetch ahead of each dependent load.
+
+namespace KeySearch
+{
+	constexpr size_t k_cacheLineSize = 64;
+
+	struct CacheLineDeleter
+	{
+		void operator()(uint32_t* data) const { ::operator delete[](data, std::align_val_t(k_cacheLineSize)); }
+	};
+
+	using CacheLineArray = std::unique_ptr<uint32_t[], CacheLineDeleter>;
+
+	inline CacheLineArray AllocateCacheLineArray(size_t count)
+	{
+		return CacheLineArray(new (std::align_val_t(k_cacheLineSize)) uint32_t[count]);
+	}
+
+	// Positions of the keys in ascending key order, ties keep their original order so Find returns the first duplicate
+	inline std::vector<uint32_t> SortedOrder(std::span<uint32_t const> keys)
+	{
+		std::vector<uint32_t> order(keys.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+		return order;
+	}
+
+	class SortedKeyIndex
+	{
+	public:
+		explicit SortedKeyIndex(std::span<uint32_t const> keys)
+			: count(keys.size())
+			, sortedKeys(AllocateCacheLineArray(keys.size()))
+			, positions(AllocateCacheLineArray(keys.size()))
+		{
+			std::vector<uint32_t> order = SortedOrder(keys);
+			for (size_t i = 0; i < count; ++i)
+			{
+				sortedKeys[i] = keys[order[i]];
+				positions[i] = order[i];
+			}
+		}
+
+		size_t Find(uint32_t target) const
+		{
+			if (count == 0) return k_notFound;
+
+			// Halve the range every step with a conditional move instead of a branch, so there are no mispredictions
+			// and the loop always runs log2(n) times. Both possible next midpoints are prefetched
+			uint32_t const* base = sortedKeys.get();
+			size_t length = count;
+			while (length > 1)
+			{
+				size_t half = length / 2;
+				_mm_prefetch((char const*)(base + half / 2), _MM_HINT_T0);
+				_mm_prefetch((char const*)(base + half + half / 2), _MM_HINT_T0);
+				base = base[half - 1] < target ? base + half : base;
+				length -= half;
+			}
+
+			if (*base != target) return k_notFound;
+			return positions[base - sortedKeys.get()];
+		}
+
+		// Searches this many targets at once, enough misses in flight to cover DRAM latency without running out of fill buffers
+		static constexpr size_t k_batchGroupSize = 16;
+
+		// Same results as calling Find for each target. Every search over the same keys takes the same number of steps, so a group
+		// of them can advance in lock step, each one prefetching its next probe and then waiting behind the rest of the group
+		// instead of stalling on its own miss
+		void FindBatch(std::span<uint32_t const> targets, std::span<size_t> results) const
+		{
+			for (size_t groupBegin = 0; groupBegin < targets.size(); groupBegin += k_batchGroupSize)
+			{
+				size_t groupSize = std::min(k_batchGroupSize, targets.size() - groupBegin);
+				FindGroup(targets.subspan(groupBegin, groupSize), results.subspan(groupBegin, groupSize));
+			}
+		}
+
+		size_t Size() const { return count; }
+
+		// Keys in ascending order, and the original column position of each, for searches that walk the index themselves
+		std::span<uint32_t const> Keys() const { return { sortedKeys.get(), count }; }
+		std::span<uint32_t const> Positions() const { return { positions.get(), count }; }
+
+	private:
+		void FindGroup(std::span<uint32_t const> targets, std::span<size_t> results) const
+		{
+			if (count == 0)
+			{
+				std::fill(results.begin(), results.end(), k_notFound);
+				return;
+			}
+
+			uint32_t const* bases[k_batchGroupSize];
+			for (size_t i = 0; i < targets.size(); ++i)
+			{
+				bases[i] = sortedKeys.get();
+			}
+
+			size_t length = count;
+			while (length > 1)
+			{
+				size_t half = length / 2;
+				size_t nextHalf = (length - half) / 2;
+				for (size_t i = 0; i < targets.size(); ++i)
+				{
+					bases[i] = bases[i][half - 1] < targets[i] ? bases[i] + half : bases[i];
+					if (nextHalf != 0) _mm_prefetch((char const*)(bases[i] + nextHalf - 1), _MM_HINT_T0);
+				}
+
+				length -= half;
+			}
+
+			// Positions are one more dependent miss, prefetched for the whole group before any of them is read
+			for (size_t i = 0; i < targets.size(); ++i)
+			{
+				_mm_prefetch((char const*)(positions.get() + (bases[i] - sortedKeys.get())), _MM_HINT_T0);
+			}
+
+			for (size_t i = 0; i < targets.size(); ++i)
+			{
+				results[i] = *bases[i] == targets[i] ? positions[bases[i] - sortedKeys.get()] : k_notFound;
+			}
+		}
+
+		size_t count;
+		CacheLineArray sortedKeys;
+		CacheLineArray positions;
+	};
+
+	class EytzingerKeyIndex
+	{
+	public:
+		explicit EytzingerKeyIndex(std::span<uint32_t const> keys)
+			: count(keys.size())
+			, layoutKeys(AllocateCacheLineArray(keys.size() + 1))
+			, positions(AllocateCacheLineArray(keys.size() + 1))
+		{
+			std::vector<uint32_t> order = SortedOrder(keys);
+			size_t sortedIndex = 0;
+			Build(keys, order, sortedIndex, 1);
+		}
+
+		size_t Find(uint32_t target) const
+		{
+			// Node k's children are 2k and 2k + 1, so the 16 descendants four levels down are contiguous at 16k.
+			// With a cache line aligned array that is exactly one cache line, fetched while the next four levels are walked
+			size_t k = 1;
+			while (k <= count)
+			{
+				_mm_prefetch((char const*)(layoutKeys.get() + k * 16), _MM_HINT_T0);
+				k = 2 * k + (layoutKeys[k] < target);
+			}
+
+			// Undo the right turns taken after the last left turn, which leaves the lower bound
+			k >>= std::countr_one(k) + 1;
+			if (k == 0 || layoutKeys[k] != target) return k_notFound;
+			return positions[k];
+		}
+
+		size_t Size() const { return count; }
+
+	private:
+		// In order traversal of the implicit tree hands out the keys in ascending order
+		void Build(std::span<uint32_t const> keys, std::vector<uint32_t> const& order, size_t& sortedIndex, size_t k)
+		{
+			if (k > count) return;
+
+			Build(keys, order, sortedIndex, 2 * k);
+			layoutKeys[k] = keys[order[sortedIndex]];
+			positions[k] = order[sortedIndex];
+			++sortedIndex;
+			Build(keys, order, sortedIndex, 2 * k + 1);
+		}
+
+		size_t count;
+		CacheLineArray layoutKeys;
+		CacheLineArray positions;
+	};
+
+	class STreeKeyIndex
+	{
+	public:
+		static constexpr size_t k_keysPerNode = k_cacheLineSize / sizeof(uint32_t);
+
+		explicit STreeKeyIndex(std::span<uint32_t const> keys)
+			: count(keys.size())
+			, nodeCount((keys.size() + k_keysPerNode - 1) / k_keysPerNode)
+			, nodeKeys(AllocateCacheLineArray(nodeCount * k_keysPerNode))
+			, positions(AllocateCacheLineArray(nodeCount * k_keysPerNode))
+		{
+			std::vector<uint32_t> order = SortedOrder(keys);
+			size_t sortedIndex = 0;
+			Build(keys, order, sortedIndex, 0);
+		}
+
+		size_t Find(uint32_t target) const
+		{
+			// SSE2 only has signed compares, flipping the sign bit maps unsigned order onto signed order
+			__m128i flippedTarget = _mm_set1_epi32((int)(target ^ k_signBit));
+			size_t candidate = k_notFound;
+			size_t node = 0;
+			while (node < nodeCount)
+			{
+				__m128i const* keysInNode = (__m128i const*)(nodeKeys.get() + node * k_keysPerNode);
+				uint32_t lessMask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(flippedTarget, _mm_load_si128(keysInNode))))
+					| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(flippedTarget, _mm_load_si128(keysInNode + 1)))) << 4)
+					| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(flippedTarget, _mm_load_si128(keysInNode + 2)))) << 8)
+					| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(flippedTarget, _mm_load_si128(keysInNode + 3)))) << 12);
+
+				// Keys in a node are sorted, so the keys less than the target form a run of low bits
+				size_t rank = (size_t)std::countr_one(lessMask);
+				if (rank < k_keysPerNode) candidate = node * k_keysPerNode + rank;
+				node = Child(node, rank);
+			}
+
+			if (candidate == k_notFound || positions[candidate] == k_padding || (nodeKeys[candidate] ^ k_signBit) != target) return k_notFound;
+			return positions[candidate];
+		}
+
+		size_t Size() const { return count; }
+
+	private:
+		static constexpr uint32_t k_signBit = 0x8000'0000u;
+		static constexpr uint32_t k_padding = UINT32_MAX;
+
+		static size_t Child(size_t node, size_t rank) { return node * (k_keysPerNode + 1) + rank + 1; }
+
+		void Build(std::span<uint32_t const> keys, std::vector<uint32_t> const& order, size_t& sortedIndex, size_t node)
+		{
+			if (node >= nodeCount) return;
+
+			for (size_t i = 0; i < k_keysPerNode; ++i)
+			{
+				Build(keys, order, sortedIndex, Child(node, i));
+
+				size_t slot = node * k_keysPerNode + i;
+				if (sortedIndex < count)
+				{
+					nodeKeys[slot] = keys[order[sortedIndex]] ^ k_signBit;
+					positions[slot] = order[sortedIndex];
+					++sortedIndex;
+				}
+				else
+				{
+					// Larger than every key, so padding never sends the search the wrong way
+					nodeKeys[slot] = UINT32_MAX ^ k_signBit;
+					positions[slot] = k_padding;
+				}
+			}
+
+			Build(keys, order, sortedIndex, Child(node, k_keysPerNode));
+		}
+
+		size_t count;
+		size_t nodeCount;
+		CacheLineArray nodeKeys;
+		CacheLineArray positions;
+	};
+
+	// Calls fn(i, *slots[positions[i]]) for every position that was found. Reading a payload through a pointer column is two
+	// dependent misses per lookup, so this takes three passes over the batch: prefetch every slot, then load each slot and
+	// prefetch what it points to, then dereference. Each pass's misses overlap instead of every lookup paying both in turn
+	template<typename Pointer, typename Fn>
+	void ForEachPointee(std::span<Pointer const> slots, std::span<size_t const> positions, Fn const& fn)
+	{
+		for (size_t position : positions)
+		{
+			if (position != k_notFound) _mm_prefetch((char const*)&slots[position], _MM_HINT_T0);
+		}
+
+		for (size_t position : positions)
+		{
+			if (position != k_notFound) _mm_prefetch((char const*)std::to_address(slots[position]), _MM_HINT_T0);
+		}
+
+		for (size_t i = 0; i < positions.size(); ++i)
+		{
+			if (positions[i] != k_notFound) fn(i, *slots[positions[i]]);
+		}
+	}
+
+} // namespace KeySearch
@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <immintrin.h>
+#include "KeyIndex.h"
+#include "MemoryResources.h"
+
+// Lookups written as coroutines that prefetch the line they need next and suspend instead of waiting for it. A round robin
+// scheduler keeps several of them in flight, so while one lookup's line is on its way the others make progress and the
+// misses overlap. Unlike SortedKeyIndex::FindBatch the lookups do not have to move in lock step, each one runs at its own
+// pace and a finished lookup's slot is refilled straight away.
+
+namespace KeySearch
+{
+	// Frames are at most this big to come from the frame pool, larger ones fall back to the heap
+	constexpr size_t k_coroutineFrameSize = 256;
+
+	// Each thread has its own pool and a finished lookup's frame is reused by the next one, so steady state lookups never touch
+	// the heap. Frames have to be destroyed on the thread that created them, which RunInterleaved does
+	inline PoolResource& GetCoroutineFramePool()
+	{
+		static thread_local PoolResource pool(k_coroutineFrameSize, 64);
+		return pool;
+	}
+
+	// A lookup that produces a T. Starts suspended, so creating it costs only the frame allocation
+	template<typename T>
+	class Lookup
+	{
+	public:
+		struct promise_type
+		{
+			T result{};
+
+			Lookup get_return_object() { return Lookup(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_value(T value) { result = std::move(value); }
+			void unhandled_exception() { std::terminate(); }
+
+			static void* operator new(size_t size) { return GetCoroutineFramePool().allocate(size, alignof(std::max_align_t)); }
+			static void operator delete(void* frame, size_t size) { GetCoroutineFramePool().deallocate(frame, size, alignof(std::max_align_t)); }
+		};
+
+		Lookup() = default;
+
+		Lookup(Lookup&& other) noexcept
+			: handle(std::exchange(other.handle, nullptr))
+		{
+		}
+
+		Lookup& operator=(Lookup&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (handle) handle.destroy();
+				handle = std::exchange(other.handle, nullptr);
+			}
+
+			return *this;
+		}
+
+		~Lookup()
+		{
+			if (handle) handle.destroy();
+		}
+
+		explicit operator bool() const { return (bool)handle; }
+		bool Done() const { return handle.done(); }
+		void Resume() { handle.resume(); }
+		T const& Result() const { return handle.promise().result; }
+
+	private:
+		explicit Lookup(std::coroutine_handle<promise_type> coroutine)
+			: handle(coroutine)
+		{
+		}
+
+		std::coroutine_handle<promise_type> handle = nullptr;
+	};
+
+	// co_await Prefetch(address) starts loading the line and hands control back to the scheduler
+	struct Prefetch
+	{
+		void const* address;
+
+		bool await_ready() const noexcept
+		{
+			_mm_prefetch((char const*)address, _MM_HINT_T0);
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<>) const noexcept {}
+		void await_resume() const noexcept {}
+	};
+
+	// The scheduler holds at most this many lookups
+	constexpr size_t k_maxLookupsInFlight = 64;
+
+	// Runs start(i) for every i in [0, count) with up to inFlight lookups at once, resuming them round robin, and passes each
+	// result to finish(i, result) as it completes. Results can arrive out of order
+	template<typename StartFn, typename FinishFn>
+	void RunInterleaved(size_t count, size_t inFlight, StartFn const& start, FinishFn const& finish)
+	{
+		using LookupType = std::invoke_result_t<StartFn const&, size_t>;
+
+		inFlight = std::clamp<size_t>(inFlight, 1, k_maxLookupsInFlight);
+		LookupType slots[k_maxLookupsInFlight];
+		size_t slotLookup[k_maxLookupsInFlight];
+		size_t next = 0;
+		size_t active = 0;
+		for (size_t slot = 0; slot < inFlight && next < count; ++slot, ++next, ++active)
+		{
+			slots[slot] = start(next);
+			slotLookup[slot] = next;
+		}
+
+		while (active > 0)
+		{
+			for (size_t slot = 0; slot < inFlight; ++slot)
+			{
+				if (!slots[slot]) continue;
+
+				slots[slot].Resume();
+				if (!slots[slot].Done()) continue;
+
+				finish(slotLookup[slot], slots[slot].Result());
+				if (next < count)
+				{
+					slots[slot] = start(next);
+					slotLookup[slot] = next++;
+				}
+				else
+				{
+					slots[slot] = LookupType();
+					--active;
+				}
+			}
+		}
+	}
+
+	// The first levels of a binary search only ever probe a few lines, which every lookup shares and keeps in cache.
+	// Suspending there is pure overhead, so the lookups only start suspending below these levels
+	constexpr size_t k_cachedSearchLevels = 10;
+
+	// SortedKeyIndex::Find, suspending before every probe below the cached levels. The step is written as arithmetic because
+	// inside a coroutine the compiler turns the usual conditional into a branch, which mispredicts half the time
+	inline Lookup<size_t> FindCoroutine(SortedKeyIndex const& index, uint32_t target)
+	{
+		std::span<uint32_t const> keys = index.Keys();
+		if (keys.empty()) co_return k_notFound;
+
+		uint32_t const* base = keys.data();
+		size_t length = keys.size();
+		size_t coldLength = keys.size() >> k_cachedSearchLevels;
+		while (length > 1)
+		{
+			size_t half = length / 2;
+			if (length <= coldLength) co_await Prefetch{ base + half - 1 };
+			base += (base[half - 1] < target) * half;
+			length -= half;
+		}
+
+		if (*base != target) co_return k_notFound;
+
+		size_t sortedIndex = (size_t)(base - keys.data());
+		co_await Prefetch{ &index.Positions()[sortedIndex] };
+		co_return index.Positions()[sortedIndex];
+	}
+
+	// Finds the key and reads the value its slot points to, suspending before the slot and the pointee loads as well
+	template<typename Pointer>
+	Lookup<std::optional<typename std::pointer_traits<Pointer>::element_type>> FindPointeeCoroutine(SortedKeyIndex const& index, std::span<Pointer const> slots, uint32_t target)
+	{
+		std::span<uint32_t const> keys = index.Keys();
+		if (keys.empty()) co_return std::nullopt;
+
+		uint32_t const* base = keys.data();
+		size_t length = keys.size();
+		size_t coldLength = keys.size() >> k_cachedSearchLevels;
+		while (length > 1)
+		{
+			size_t half = length / 2;
+			if (length <= coldLength) co_await Prefetch{ base + half - 1 };
+			base += (base[half - 1] < target) * half;
+			length -= half;
+		}
+
+		if (*base != target) co_return std::nullopt;
+
+		size_t sortedIndex = (size_t)(base - keys.data());
+		co_await Prefetch{ &index.Positions()[sortedIndex] };
+		Pointer const& slot = slots[index.Positions()[sortedIndex]];
+		co_await Prefetch{ &slot };
+		co_await Prefetch{ std::to_address(slot) };
+		co_return *slot;
+	}
+
+} // namespace KeySearch
@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <immintrin.h>
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+// Linear key search over a structure of arrays key column, returning the index of the first match so it can be used to
+// look up the parallel value arrays. The SIMD kernels compare 4, 8 or 16 keys per instruction, OR four compares
+// together so the common no-match case costs a single branch per 16/32/64 keys, and only then use a movemask to find the hit.
+
+namespace KeySearch
+{
+	constexpr size_t k_notFound = SIZE_MAX;
+
+	using FindKeyFn = size_t(*)(uint32_t const* keys, size_t count, uint32_t target);
+
+	inline size_t FindKeyScalar(uint32_t const* keys, size_t count, uint32_t target)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (keys[i] == target) return i;
+		}
+
+		return k_notFound;
+	}
+
+	// Only needs SSE2, which every x64 CPU has
+	inline size_t FindKeySse(uint32_t const* keys, size_t count, uint32_t target)
+	{
+		__m128i targets = _mm_set1_epi32((int)target);
+		size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i match0 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(keys + i)), targets);
+			__m128i match1 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(keys + i + 4)), targets);
+			__m128i match2 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(keys + i + 8)), targets);
+			__m128i match3 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(keys + i + 12)), targets);
+			__m128i anyMatch = _mm_or_si128(_mm_or_si128(match0, match1), _mm_or_si128(match2, match3));
+			if (_mm_movemask_epi8(anyMatch) == 0) continue;
+
+			// One bit per key, so the lowest set bit is the first match
+			uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(match0))
+				| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(match1)) << 4)
+				| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(match2)) << 8)
+				| ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(match3)) << 12);
+			return i + (size_t)std::countr_zero(mask);
+		}
+
+		size_t tail = FindKeyScalar(keys + i, count - i, target);
+		return tail == k_notFound ? k_notFound : i + tail;
+	}
+
+	TargetAvx2 inline size_t FindKeyAvx2(uint32_t const* keys, size_t count, uint32_t target)
+	{
+		__m256i targets = _mm256_set1_epi32((int)target);
+		size_t i = 0;
+		for (; i + 32 <= count; i += 32)
+		{
+			__m256i match0 = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i const*)(keys + i)), targets);
+			__m256i match1 = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i const*)(keys + i + 8)), targets);
+			__m256i match2 = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i const*)(keys + i + 16)), targets);
+			__m256i match3 = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i const*)(keys + i + 24)), targets);
+			__m256i anyMatch = _mm256_or_si256(_mm256_or_si256(match0, match1), _mm256_or_si256(match2, match3));
+			if (_mm256_testz_si256(anyMatch, anyMatch)) continue;
+
+			uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(match0))
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(match1)) << 8)
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(match2)) << 16)
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(match3)) << 24);
+			return i + (size_t)std::countr_zero(mask);
+		}
+
+		size_t tail = FindKeySse(keys + i, count - i, target);
+		return tail == k_notFound ? k_notFound : i + tail;
+	}
+
+	TargetAvx512 inline size_t FindKeyAvx512(uint32_t const* keys, size_t count, uint32_t target)
+	{
+		__m512i targets = _mm512_set1_epi32((int)target);
+		size_t i = 0;
+		for (; i + 64 <= count; i += 64)
+		{
+			// Compares write straight into mask registers, so no movemask is needed
+			__mmask16 match0 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(keys + i), targets);
+			__mmask16 match1 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(keys + i + 16), targets);
+			__mmask16 match2 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(keys + i + 32), targets);
+			__mmask16 match3 = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(keys + i + 48), targets);
+			uint64_t mask = (uint64_t)match0 | ((uint64_t)match1 << 16) | ((uint64_t)match2 << 32) | ((uint64_t)match3 << 48);
+			if (mask == 0) continue;
+
+			return i + (size_t)std::countr_zero(mask);
+		}
+
+		// Masked load for the tail, lanes past the end are never read
+		for (; i < count; i += 16)
+		{
+			size_t remaining = count - i < 16 ? count - i : 16;
+			__mmask16 loadMask = (__mmask16)((1u << remaining) - 1);
+			__mmask16 match = _mm512_mask_cmpeq_epi32_mask(loadMask, _mm512_maskz_loadu_epi32(loadMask, keys + i), targets);
+			if (match != 0) return i + (size_t)std::countr_zero((uint32_t)match);
+		}
+
+		return k_notFound;
+	}
+
+	// Picks the widest kernel the CPU supports, once
+	inline FindKeyFn GetFindKeyKernel()
+	{
+		static FindKeyFn const kernel = [] {
+			CpuFeatures const& features = CpuFeatures::Get();
+			if (features.avx512f && features.popcnt) return &FindKeyAvx512;
+			if (features.avx2 && features.popcnt) return &FindKeyAvx2;
+			return &FindKeySse;
+		}();
+
+		return kernel;
+	}
+
+	inline size_t FindKey(uint32_t const* keys, size_t count, uint32_t target)
+	{
+		return GetFindKeyKernel()(keys, count, target);
+	}
+
+	// Each thread scans its own chunk with the dispatched kernel and the lowest hit wins. Chunks are not cancelled when
+	// another thread finds the key, so this pays off for misses and late hits in large columns
+	inline size_t ParallelFindKey(uint32_t const* keys, size_t count, uint32_t target, uint32_t threadCount, ThreadPool& pool = ThreadPool::Get())
+	{
+		return pool.ParallelReduce(count, threadCount, k_notFound,
+			[&](size_t begin, size_t end) {
+				size_t index = FindKey(keys + begin, end - begin, target);
+				return index == k_notFound ? k_notFound : begin + index;
+			},
+			[](size_t a, size_t b) { return std::min(a, b); });
+	}
+
+} // namespace KeySearch
@@ -0,0 +1,342 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// std::pmr::memory_resource implementations for allocation patterns the standard resources handle poorly.
+// ArenaResource: bump allocation, individual frees are no-ops and Reset frees everything at once
+// PoolResource: fixed size blocks on a free list, with a per thread cache so most allocations take no lock
+// FrameResource: two arenas used on alternate frames, so an allocation lives until the end of the next frame
+
+class ArenaResource : public std::pmr::memory_resource
+{
+public:
+	explicit ArenaResource(size_t initialCapacity, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+		: upstream(upstream)
+	{
+		AddBlock(initialCapacity);
+	}
+
+	~ArenaResource() override
+	{
+		ReleaseBlocks();
+	}
+
+	ArenaResource(ArenaResource const&) = delete;
+	ArenaResource& operator=(ArenaResource const&) = delete;
+
+	// O(1) once the arena has seen its largest frame. An arena that overflowed into extra blocks frees them and
+	// replaces the first block with one big enough for everything that was allocated, so the next pass fits in one block
+	void Reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t highWaterMark = usedInFullBlocks + offset;
+			ReleaseBlocks();
+			AddBlock(highWaterMark);
+		}
+
+		offset = 0;
+		usedInFullBlocks = 0;
+	}
+
+	size_t Capacity() const { return blocks.empty() ? 0 : blocks.back().size; }
+
+private:
+	struct Block
+	{
+		std::byte* data;
+		size_t size;
+	};
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		size_t alignedOffset = AlignUp(offset, alignment);
+		if (alignedOffset + bytes > current.size)
+		{
+			usedInFullBlocks += offset;
+			AddBlock(std::max(bytes + alignment, current.size * 2));
+			alignedOffset = AlignUp(offset, alignment);
+		}
+
+		offset = alignedOffset + bytes;
+		return current.data + alignedOffset;
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+	// Aligns the address rather than the offset, blocks from upstream are only max_align_t aligned.
+	// Alignments are always powers of two, so this is a mask instead of a divide
+	size_t AlignUp(size_t value, size_t alignment) const
+	{
+		uintptr_t address = (uintptr_t)current.data + value;
+		return value + ((0 - address) & (alignment - 1));
+	}
+
+	void AddBlock(size_t size)
+	{
+		size = std::max<size_t>(size, 64);
+		current = { (std::byte*)upstream->allocate(size, alignof(std::max_align_t)), size };
+		blocks.push_back(current);
+		offset = 0;
+	}
+
+	void ReleaseBlocks()
+	{
+		for (Block const& block : blocks)
+		{
+			upstream->deallocate(block.data, block.size, alignof(std::max_align_t));
+		}
+
+		blocks.clear();
+		current = {};
+	}
+
+	std::pmr::memory_resource* upstream;
+	std::vector<Block> blocks;
+	Block current = {};
+	size_t offset = 0;
+	size_t usedInFullBlocks = 0;
+};
+
+class PoolResource : public std::pmr::memory_resource
+{
+public:
+	// Allocations larger than blockSize or more aligned than max_align_t go straight to upstream
+	explicit PoolResource(size_t blockSize, size_t blocksPerChunk = 1024, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+		: blockSize(AlignBlockSize(blockSize))
+		, blocksPerChunk(blocksPerChunk)
+		, upstream(upstream)
+		, id(s_nextId.fetch_add(1, std::memory_order_relaxed))
+	{
+		std::lock_guard lock(s_registryMutex);
+		s_livePools.emplace(id, this);
+	}
+
+	~PoolResource() override
+	{
+		{
+			std::lock_guard lock(s_registryMutex);
+			s_livePools.erase(id);
+		}
+
+		// Blocks still sitting in thread caches belong to these chunks, the cache entries are dropped lazily by id
+		for (std::byte* chunk : chunks)
+		{
+			upstream->deallocate(chunk, blockSize * blocksPerChunk, alignof(std::max_align_t));
+		}
+	}
+
+	PoolResource(PoolResource const&) = delete;
+	PoolResource& operator=(PoolResource const&) = delete;
+
+	size_t BlockSize() const { return blockSize; }
+
+	size_t ChunkCount() const
+	{
+		std::lock_guard lock(mutex);
+		return chunks.size();
+	}
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	// Free blocks this thread may hand out without a lock, for the last few pools the thread used
+	struct ThreadCacheEntry
+	{
+		uint64_t poolId = 0;
+		FreeBlock* head = nullptr;
+		uint32_t count = 0;
+	};
+
+	static constexpr uint32_t k_threadCacheEntries = 8;
+	static constexpr uint32_t k_threadCacheLimit = 256;
+
+	// A thread that exits hands its cached blocks back, so short lived threads do not strand them
+	struct ThreadCache
+	{
+		~ThreadCache()
+		{
+			for (ThreadCacheEntry& entry : entries)
+			{
+				ReturnToOwner(entry);
+			}
+		}
+
+		ThreadCacheEntry entries[k_threadCacheEntries];
+		uint32_t nextEviction = 0;
+	};
+
+	static inline std::atomic<uint64_t> s_nextId = 1;
+	static thread_local ThreadCache t_cache;
+
+	// Live pools by id, so a cache entry can find its pool without keeping it alive. Only used on the slow paths
+	static inline std::mutex s_registryMutex;
+	static inline std::unordered_map<uint64_t, PoolResource*> s_livePools;
+
+	static size_t AlignBlockSize(size_t size)
+	{
+		size_t alignment = alignof(std::max_align_t);
+		return (std::max(size, sizeof(FreeBlock)) + alignment - 1) / alignment * alignment;
+	}
+
+	bool IsPooled(size_t bytes, size_t alignment) const
+	{
+		return bytes <= blockSize && alignment <= alignof(std::max_align_t);
+	}
+
+	// Gives an entry's blocks back to its pool's shared list and clears it. Holding the registry lock keeps the pool
+	// from being destroyed meanwhile, a pool that is already gone took its blocks with it
+	static void ReturnToOwner(ThreadCacheEntry& entry)
+	{
+		if (entry.head)
+		{
+			std::lock_guard lock(s_registryMutex);
+			auto owner = s_livePools.find(entry.poolId);
+			if (owner != s_livePools.end()) owner->second->Flush(entry, entry.count);
+		}
+
+		entry = {};
+	}
+
+	// More pools in use on one thread than it has entries for makes them take turns, evicting flushes to the shared list
+	ThreadCacheEntry& GetCacheEntry()
+	{
+		ThreadCache& cache = t_cache;
+		for (ThreadCacheEntry& entry : cache.entries)
+		{
+			if (entry.poolId == id) return entry;
+		}
+
+		ThreadCacheEntry& entry = cache.entries[cache.nextEviction];
+		cache.nextEviction = (cache.nextEviction + 1) % k_threadCacheEntries;
+		ReturnToOwner(entry);
+		entry = { id, nullptr, 0 };
+		return entry;
+	}
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		if (!IsPooled(bytes, alignment)) return upstream->allocate(bytes, alignment);
+
+		ThreadCacheEntry& entry = GetCacheEntry();
+		if (!entry.head) Refill(entry);
+
+		FreeBlock* block = entry.head;
+		entry.head = block->next;
+		--entry.count;
+		return block;
+	}
+
+	void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+	{
+		if (!IsPooled(bytes, alignment))
+		{
+			upstream->deallocate(pointer, bytes, alignment);
+			return;
+		}
+
+		ThreadCacheEntry& entry = GetCacheEntry();
+		FreeBlock* block = (FreeBlock*)pointer;
+		block->next = entry.head;
+		entry.head = block;
+		++entry.count;
+
+		// A thread that frees more than it allocates hands half its cache back for other threads
+		if (entry.count > k_threadCacheLimit) Flush(entry, k_threadCacheLimit / 2);
+	}
+
+	bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+	// Takes half a cache worth of blocks from the shared list, carving a new chunk if that is empty
+	void Refill(ThreadCacheEntry& entry)
+	{
+		std::unique_lock lock(mutex);
+		if (!sharedFreeList)
+		{
+			// Upstream may be another pool that takes the registry lock, which is held while taking this one
+			lock.unlock();
+			std::byte* chunk = (std::byte*)upstream->allocate(blockSize * blocksPerChunk, alignof(std::max_align_t));
+			lock.lock();
+			chunks.push_back(chunk);
+			for (size_t i = blocksPerChunk; i-- > 0;)
+			{
+				FreeBlock* block = (FreeBlock*)(chunk + i * blockSize);
+				block->next = sharedFreeList;
+				sharedFreeList = block;
+			}
+		}
+
+		for (uint32_t i = 0; i < k_threadCacheLimit / 2 && sharedFreeList; ++i)
+		{
+			FreeBlock* block = sharedFreeList;
+			sharedFreeList = block->next;
+			block->next = entry.head;
+			entry.head = block;
+			++entry.count;
+		}
+	}
+
+	void Flush(ThreadCacheEntry& entry, uint32_t count)
+	{
+		std::lock_guard lock(mutex);
+		for (uint32_t i = 0; i < count && entry.head; ++i)
+		{
+			FreeBlock* block = entry.head;
+			entry.head = block->next;
+			--entry.count;
+			block->next = sharedFreeList;
+			sharedFreeList = block;
+		}
+	}
+
+	size_t blockSize;
+	size_t blocksPerChunk;
+	std::pmr::memory_resource* upstream;
+	uint64_t id;
+
+	mutable std::mutex mutex;
+	FreeBlock* sharedFreeList = nullptr;
+	std::vector<std::byte*> chunks;
+};
+
+inline thread_local PoolResource::ThreadCache PoolResource::t_cache;
+
+class FrameResource : public std::pmr::memory_resource
+{
+public:
+	explicit FrameResource(size_t capacityPerFrame, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+		: arenas{ ArenaResource(capacityPerFrame, upstream), ArenaResource(capacityPerFrame, upstream) }
+	{
+	}
+
+	// Everything allocated two frames ago is freed, last frame's allocations stay readable through this frame
+	void NextFrame()
+	{
+		currentArena ^= 1;
+		arenas[currentArena].Reset();
+	}
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		return arenas[currentArena].allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+	ArenaResource arenas[2];
+	uint32_t currentArena = 0;
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <immintrin.h>
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+// Counting the values that pass a predicate without branching on each value, so the cost no longer depends on how
+// predictable the data is. The scalar kernel turns the compare into a setcc and an add, the SIMD kernels compare 8 (AVX2)
+// or 16 (AVX-512) values per instruction and popcount the resulting mask.
+
+// Keeps the compiler from vectorizing a loop that is meant to show the scalar instruction sequence.
+// GCC only has a loop pragma from 14 on, older versions may still vectorize it
+#if defined(__clang__)
+#define ScalarLoop _Pragma("clang loop vectorize(disable) interleave(disable)")
+#elif defined(_MSC_VER)
+#define ScalarLoop __pragma(loop(no_vector))
+#elif defined(__GNUC__) && __GNUC__ >= 14
+#define ScalarLoop _Pragma("GCC novector")
+#else
+#define ScalarLoop
+#endif
+
+namespace PredicateCount
+{
+	using CountGreaterThanFn = size_t(*)(uint32_t const* values, size_t count, uint32_t threshold);
+
+	inline size_t CountGreaterThanBranchless(uint32_t const* values, size_t count, uint32_t threshold)
+	{
+		size_t total = 0;
+		ScalarLoop
+		for (size_t i = 0; i < count; i++)
+		{
+			total += values[i] > threshold;
+		}
+
+		return total;
+	}
+
+	// AVX2 only has a signed compare, flipping the sign bit of both sides maps unsigned order onto signed order
+	TargetAvx2 inline size_t CountGreaterThanAvx2(uint32_t const* values, size_t count, uint32_t threshold)
+	{
+		__m256i signBit = _mm256_set1_epi32((int)0x8000'0000u);
+		__m256i flippedThreshold = _mm256_xor_si256(_mm256_set1_epi32((int)threshold), signBit);
+		size_t total = 0;
+		size_t i = 0;
+		for (; i + 32 <= count; i += 32)
+		{
+			// Four independent compares per iteration so the popcounts are not one long dependency chain
+			__m256i greater0 = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_loadu_si256((__m256i const*)(values + i)), signBit), flippedThreshold);
+			__m256i greater1 = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_loadu_si256((__m256i const*)(values + i + 8)), signBit), flippedThreshold);
+			__m256i greater2 = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_loadu_si256((__m256i const*)(values + i + 16)), signBit), flippedThreshold);
+			__m256i greater3 = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_loadu_si256((__m256i const*)(values + i + 24)), signBit), flippedThreshold);
+
+			uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(greater0))
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(greater1)) << 8)
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(greater2)) << 16)
+				| ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(greater3)) << 24);
+			total += (size_t)_mm_popcnt_u32(mask);
+		}
+
+		return total + CountGreaterThanBranchless(values + i, count - i, threshold);
+	}
+
+	TargetAvx512 inline size_t CountGreaterThanAvx512(uint32_t const* values, size_t count, uint32_t threshold)
+	{
+		// AVX-512 has unsigned compares that write straight into a mask register
+		__m512i thresholds = _mm512_set1_epi32((int)threshold);
+		size_t total = 0;
+		size_t i = 0;
+		for (; i + 64 <= count; i += 64)
+		{
+			__mmask16 greater0 = _mm512_cmpgt_epu32_mask(_mm512_loadu_si512(values + i), thresholds);
+			__mmask16 greater1 = _mm512_cmpgt_epu32_mask(_mm512_loadu_si512(values + i + 16), thresholds);
+			__mmask16 greater2 = _mm512_cmpgt_epu32_mask(_mm512_loadu_si512(values + i + 32), thresholds);
+			__mmask16 greater3 = _mm512_cmpgt_epu32_mask(_mm512_loadu_si512(values + i + 48), thresholds);
+			uint64_t mask = (uint64_t)greater0 | ((uint64_t)greater1 << 16) | ((uint64_t)greater2 << 32) | ((uint64_t)greater3 << 48);
+			total += (size_t)_mm_popcnt_u64(mask);
+		}
+
+		// Masked load for the tail, lanes past the end are never read
+		for (; i < count; i += 16)
+		{
+			size_t remaining = count - i < 16 ? count - i : 16;
+			__mmask16 loadMask = (__mmask16)((1u << remaining) - 1);
+			__mmask16 greater = _mm512_mask_cmpgt_epu32_mask(loadMask, _mm512_maskz_loadu_epi32(loadMask, values + i), thresholds);
+			total += (size_t)_mm_popcnt_u32(greater);
+		}
+
+		return total;
+	}
+
+	// Picks the widest kernel the CPU supports, once
+	inline CountGreaterThanFn GetCountGreaterThanKernel()
+	{
+		static CountGreaterThanFn const kernel = [] {
+			CpuFeatures const& features = CpuFeatures::Get();
+			if (features.avx512f && features.popcnt) return &CountGreaterThanAvx512;
+			if (features.avx2 && features.popcnt) return &CountGreaterThanAvx2;
+			return &CountGreaterThanBranchless;
+		}();
+
+		return kernel;
+	}
+
+	inline size_t CountGreaterThan(uint32_t const* values, size_t count, uint32_t threshold)
+	{
+		return GetCountGreaterThanKernel()(values, count, threshold);
+	}
+
+	inline size_t ParallelCountGreaterThan(uint32_t const* values, size_t count, uint32_t threshold, uint32_t threadCount, ThreadPool& pool = ThreadPool::Get())
+	{
+		return pool.ParallelReduce(count, threadCount, (size_t)0,
+			[&](size_t begin, size_t end) { return CountGreaterThan(values + begin, end - begin, threshold); },
+			[](size_t a, size_t b) { return a + b; });
+	}
+
+} // namespace PredicateCount
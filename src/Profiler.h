@@ -2,19 +2,31 @@
 
 #define NameConcat2(A,B) A##B
 #define NameConcat(A, B) NameConcat2(A,B)
-#define ProfileBlock(functionName, lineNumber, bytesProcessed) Profiler::ScopedProfiler NameConcat(Block,__LINE__)(functionName, lineNumber, bytesProcessed)
+// Each call site is bound at compile time to its own slot in the translation unit's anchor table via __COUNTER__
+#define ProfileBlock(functionName, lineNumber, bytesProcessed) Profiler::ScopedProfiler NameConcat(Block,__LINE__)(Profiler::GetAnchor<__COUNTER__>(), functionName, lineNumber, bytesProcessed)
 #define ProfileScope ProfileBlock(__func__, __LINE__, 0)
 #define ProfileScopeThroughput(bytesProcessed) ProfileBlock(__func__, __LINE__, bytesProcessed)
 #define ProfileLabelledScope(label) ProfileBlock(label, __LINE__, 0)
 #define ProfileLabelledScopeThroughput(label, bytesProcessed) ProfileBlock(label, __LINE__, bytesProcessed)
 #define PrintProfilingResults Profiler::Profiler::PrintResults()
+#if PROFILER_TRACE
+#define WriteProfilingTrace(path) Profiler::TraceRecorder::Get().WriteTrace(path)
+#else
+#define WriteProfilingTrace(path)
+#endif
 
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <fstream>
+#include <iomanip>
 #include <optional>
-#include <unordered_map>
-#include <stack>
-#include <string_view>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 #include <iostream>
 
 #if _WIN32
@@ -49,27 +61,73 @@ namespace Profiler
 		return memoryCounters.PageFaultCount;
 	}
 
+	static void ReadCpuid(uint32_t leaf, uint32_t subLeaf, uint32_t registers[4])
+	{
+		int values[4] = {};
+		__cpuidex(values, (int)leaf, (int)subLeaf);
+		for (int i = 0; i < 4; ++i)
+		{
+			registers[i] = (uint32_t)values[i];
+		}
+	}
+
+	// Windows does not expose the TSC frequency, fall back to measuring it
+	static uint64_t ReadOsTscFrequency()
+	{
+		return 0;
+	}
+
 
 #else //_WIN32
 
 #include <x86intrin.h>
-#include <sys/time.h>
+#include <cpuid.h>
+#include <sys/resource.h>
+#include <time.h>
 
 namespace Profiler
 {
 
-	static uint64_t GetOSTimerFreq(void)
+	static uint64_t GetOsTimerFrequency()
 	{
-		return 1000000;
+		return 1'000'000'000;
 	}
 
-	static uint64_t ReadOSTimer(void)
+	static uint64_t ReadOsTimer()
 	{
-		timeval Value;
-		gettimeofday(&Value, 0);
+		// Raw monotonic clock is not slewed by NTP, so it is safe to calibrate against
+		timespec value;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &value);
 
-		u64 Result = GetOSTimerFreq() * (u64)Value.tv_sec + (u64)Value.tv_usec;
-		return Result;
+		return GetOsTimerFrequency() * (uint64_t)value.tv_sec + (uint64_t)value.tv_nsec;
+	}
+
+	// Minor (no disk IO) plus major (disk IO) faults, to match the single count Windows reports
+	static uint64_t ReadOsPageFaults()
+	{
+		rusage usage{};
+		getrusage(RUSAGE_SELF, &usage);
+
+		return (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+	}
+
+	static void ReadCpuid(uint32_t leaf, uint32_t subLeaf, uint32_t registers[4])
+	{
+		registers[0] = registers[1] = registers[2] = registers[3] = 0;
+		__cpuid_count(leaf, subLeaf, registers[0], registers[1], registers[2], registers[3]);
+	}
+
+	// Only present on some kernels, reports the frequency the kernel calibrated the TSC to
+	static uint64_t ReadOsTscFrequency()
+	{
+		std::ifstream file("/sys/devices/system/cpu/cpu0/tsc_freq_khz");
+		uint64_t frequencyKhz = 0;
+		if (file >> frequencyKhz)
+		{
+			return frequencyKhz * 1000;
+		}
+
+		return 0;
 	}
 
 #endif // _WIN32
@@ -91,7 +149,48 @@ namespace Profiler
 		uint64_t const k_CpuFrequencyHz;
 
 	private:
-		uint64_t CalculateCpuFrequency(uint64_t timeToSampleForMs) const noexcept
+		// Intel CPUs report the TSC as a ratio of the core crystal clock in CPUID leaf 0x15
+		static uint64_t ReadCpuidTscFrequency() noexcept
+		{
+			uint32_t registers[4];
+			ReadCpuid(0, 0, registers);
+			uint32_t maxLeaf = registers[0];
+			if (maxLeaf < 0x15) return 0;
+
+			ReadCpuid(0x15, 0, registers);
+			uint64_t denominator = registers[0];
+			uint64_t numerator = registers[1];
+			uint64_t crystalHz = registers[2];
+			if (denominator == 0 || numerator == 0) return 0;
+
+			// Some parts leave the crystal frequency blank, derive it from the base frequency in leaf 0x16 instead
+			if (crystalHz == 0 && maxLeaf >= 0x16)
+			{
+				ReadCpuid(0x16, 0, registers);
+				uint64_t baseHz = (uint64_t)registers[0] * 1'000'000;
+				crystalHz = baseHz * denominator / numerator;
+			}
+
+			return crystalHz * numerator / denominator;
+		}
+
+		// Prefer frequencies the hardware or OS already know about, measuring costs timeToSampleForMs of startup
+		static uint64_t ReadCpuFrequency(uint64_t timeToSampleForMs) noexcept
+		{
+			if (uint64_t cpuidFreq = ReadCpuidTscFrequency(); cpuidFreq)
+			{
+				return cpuidFreq;
+			}
+
+			if (uint64_t osFreq = ReadOsTscFrequency(); osFreq)
+			{
+				return osFreq;
+			}
+
+			return CalculateCpuFrequency(timeToSampleForMs);
+		}
+
+		static uint64_t CalculateCpuFrequency(uint64_t timeToSampleForMs) noexcept
 		{
 			uint64_t osFreq = GetOsTimerFrequency();
 			uint64_t cpuStart = ReadCpuTimer();
@@ -118,7 +217,7 @@ namespace Profiler
 			return cpuFreq;
 		}
 
-		CpuStats() : k_CpuFrequencyHz(CalculateCpuFrequency(100 /*Sample for 100 ms*/))
+		CpuStats() : k_CpuFrequencyHz(ReadCpuFrequency(100 /*Sample for 100 ms*/))
 		{}
 
 		~CpuStats() = default;
@@ -140,14 +239,20 @@ namespace Profiler
 
 		uint64_t GetPageFaults()
 		{
+#if _WIN32
 			return ReadOsPageFaults(processHandle);
+#else
+			return ReadOsPageFaults();
+#endif
 		}
 
 	private:
 		OsStats() = default;
 		~OsStats() = default;
 
+#if _WIN32
 		HANDLE processHandle = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, GetCurrentProcessId());
+#endif
 
 		OsStats(OsStats const&) = delete;
 		OsStats& operator=(OsStats const&) = delete;
@@ -161,10 +266,68 @@ namespace Profiler
 		uint64_t hitCount = 0;
 		uint64_t bytesProcessed = 0;
 
+		// Only filled in when built with PROFILER_TRACK_ALLOCATIONS. Count and bytes are for allocations made directly in
+		// this scope, peak live bytes includes children and is the most this scope's heap use grew above where it started
+		uint64_t allocationCount = 0;
+		uint64_t bytesAllocated = 0;
+		uint64_t peakLiveBytes = 0;
+
+		// Call site identity, only read when printing results
+		char const* label = nullptr;
+		int lineNumber = 0;
+
 		inline uint64_t ChildExclusiveDuration() const { return totalElapsedTime - childrenTotalElapsedTime; }
 	};
 
+	// Maximum number of profiled call sites per translation unit
+	constexpr uint32_t k_MaxAnchors = 1024;
+
+	struct AnchorTable
+	{
+		uint32_t threadIndex = 0;
+		std::unique_ptr<ProfileResult[]> anchors;
+		uint32_t count = 0;
+	};
+
+	// Innermost profiler currently running on this thread, used to attribute child time to its parent
+	inline thread_local ProfileResult* t_activeAnchor = nullptr;
+
+	// 1 based index of this thread in the profiler output, 0 until the thread first hits a profiled scope
+	inline thread_local uint32_t t_threadIndex = 0;
 
+#if PROFILER_TRACK_ALLOCATIONS
+	// Bytes this thread allocated minus bytes it freed. Memory freed by a different thread makes this drift,
+	// so only the change within a scope is meaningful
+	inline thread_local int64_t t_liveBytes = 0;
+
+	// Highest t_liveBytes since the innermost running scope began
+	inline thread_local int64_t t_peakLiveBytes = 0;
+
+	// Called by the global operator new/delete replacements in ProfilerAllocationHooks.cpp
+	inline void RecordAllocation(size_t size)
+	{
+		t_liveBytes += (int64_t)size;
+		t_peakLiveBytes = std::max(t_peakLiveBytes, t_liveBytes);
+		if (ProfileResult* anchor = t_activeAnchor)
+		{
+			++anchor->allocationCount;
+			anchor->bytesAllocated += size;
+		}
+	}
+
+	inline void RecordFree(size_t size)
+	{
+		t_liveBytes -= (int64_t)size;
+	}
+#endif // PROFILER_TRACK_ALLOCATIONS
+
+#if PROFILER_TRACE
+	inline void CreateThreadTraceBuffer();
+#endif
+
+	// Each thread writes only to its own anchor tables, so the hot path needs no synchronization.
+	// Tables are owned here rather than by the thread so results survive the thread exiting,
+	// and are merged when printing. Print once the profiled threads have finished or been joined.
 	class ProfilerResultsHolder
 	{
 	public:
@@ -174,72 +337,142 @@ namespace Profiler
 			return instance;
 		}
 
-		std::unordered_map<std::string, ProfileResult> const& GetResults() const
+		std::vector<AnchorTable> const& GetAnchorTables() const
 		{
-			return results;
+			return anchorTables;
 		}
 
-		ProfileResult* GetResult(std::string const& key)
+		// Only called the first time a thread hits a profiled scope in a translation unit
+		ProfileResult* CreateThreadAnchorTable(uint32_t count)
 		{
-			results.try_emplace(key);
+			std::lock_guard lock(registrationMutex);
+
+			if (t_threadIndex == 0)
+			{
+				t_threadIndex = ++threadCount;
+			}
+
+			AnchorTable& table = anchorTables.emplace_back();
+			table.threadIndex = t_threadIndex;
+			table.anchors = std::make_unique<ProfileResult[]>(count);
+			table.count = count;
 
-			return &results.at(key);
+#if PROFILER_TRACE
+			// Here rather than on the first event, so the buffer is never allocated inside a running scope
+			CreateThreadTraceBuffer();
+#endif
+			return table.anchors.get();
 		}
 
-		uint64_t GetTotalTime()
+		uint64_t GetTotalTime(std::vector<ProfileResult> const& results) const
 		{
-			if (totalTimeSampled == 0)
+			uint64_t totalTime = 0;
+			for (ProfileResult const& result : results)
 			{
-				for (auto const& [key, result] : results)
-				{
-					totalTimeSampled += result.ChildExclusiveDuration();
-				}
+				totalTime += result.ChildExclusiveDuration();
 			}
 
-			return totalTimeSampled;
+			return totalTime;
 		}
 
-		void PushProfilerLabel(std::string const& label)
+		uint64_t GetTotalTime() const
 		{
-			profilerStack.push(label);
+			return GetTotalTime(MergeResults(0));
 		}
 
-		void PopProfilerLabel()
+		// Merges every call site with the same label, threadIndex 0 merges across all threads
+		std::vector<ProfileResult> MergeResults(uint32_t threadIndex) const
 		{
-			profilerStack.pop();
-		}
+			std::lock_guard lock(registrationMutex);
 
-		std::optional<ProfileResult*> GetParentProfilerResult()
-		{
-			if (profilerStack.size() < 2) return std::nullopt;
+			std::vector<ProfileResult> merged;
+			std::map<std::string, size_t> mergedIndices;
+			for (AnchorTable const& table : anchorTables)
+			{
+				if (threadIndex != 0 && table.threadIndex != threadIndex) continue;
 
-			auto currentLabel = profilerStack.top();
-			profilerStack.pop();
-			auto parentLabel = profilerStack.top();
-			profilerStack.push(currentLabel);
+				for (uint32_t i = 0; i < table.count; ++i)
+				{
+					ProfileResult const& result = table.anchors[i];
+					if (result.hitCount == 0) continue;
+
+					auto [it, inserted] = mergedIndices.try_emplace(GetLabel(result), merged.size());
+					if (inserted)
+					{
+						merged.push_back(result);
+						continue;
+					}
+
+					ProfileResult& mergedResult = merged[it->second];
+					mergedResult.totalElapsedTime += result.totalElapsedTime;
+					mergedResult.childrenTotalElapsedTime += result.childrenTotalElapsedTime;
+					mergedResult.rootElapsedTime = std::max(mergedResult.rootElapsedTime, result.rootElapsedTime);
+					mergedResult.hitCount += result.hitCount;
+					mergedResult.bytesProcessed += result.bytesProcessed;
+					mergedResult.allocationCount += result.allocationCount;
+					mergedResult.bytesAllocated += result.bytesAllocated;
+					mergedResult.peakLiveBytes = std::max(mergedResult.peakLiveBytes, result.peakLiveBytes);
+				}
+			}
 
-			return GetResult(parentLabel);
+			return merged;
 		}
 
 		void PrintResults()
 		{
 			CpuStats& cpuStats = CpuStats::Get();
-			uint64_t totalTime = GetTotalTime();
+			uint32_t profiledThreadCount = 0;
+			{
+				std::lock_guard lock(registrationMutex);
+				profiledThreadCount = threadCount;
+			}
+
+			// Per thread breakdown is only useful when more than one thread was profiled
+			if (profiledThreadCount > 1)
+			{
+				for (uint32_t threadIndex = 1; threadIndex <= profiledThreadCount; ++threadIndex)
+				{
+					std::vector<ProfileResult> threadResults = MergeResults(threadIndex);
+					uint64_t threadTime = GetTotalTime(threadResults);
+
+					std::cout << "Thread " << threadIndex << ": ";
+					if (cpuStats.k_CpuFrequencyHz)
+					{
+						std::cout << (double)threadTime / (double)cpuStats.k_CpuFrequencyHz << "s";
+					}
+					std::cout << "\n\n";
+
+					for (ProfileResult const& result : threadResults)
+					{
+						PrintTimeElapsed(GetLabel(result), threadTime, result);
+					}
+				}
+
+				std::cout << "All threads:\n";
+			}
+
+			std::vector<ProfileResult> results = MergeResults(0);
+			uint64_t totalTime = GetTotalTime(results);
 
 			if (cpuStats.k_CpuFrequencyHz)
 			{
 				std::cout << "Total time: " << (double)totalTime / (double)cpuStats.k_CpuFrequencyHz << "s CPU Freq: " << cpuStats.k_CpuFrequencyHz << "hz\n\n";
 			}
 
-			for (auto const& [label, result] : results)
+			for (ProfileResult const& result : results)
 			{
-				PrintTimeElapsed(label, totalTime, result);
+				PrintTimeElapsed(GetLabel(result), totalTime, result);
 			}
 		}
 
 	private:
 		ProfilerResultsHolder() = default;
 
+		static std::string GetLabel(ProfileResult const& result)
+		{
+			return std::string(result.label) + std::to_string(result.lineNumber);
+		}
+
 		void PrintTimeElapsed(std::string const& timeSectionName, uint64_t totalTime, ProfileResult const& result)
 		{
 			double percent = 100.0 * ((double)result.ChildExclusiveDuration() / (double)totalTime);
@@ -263,45 +496,272 @@ namespace Profiler
 				std::cout << "\tThroughput: " << megabytesProcessed << "mb " << gigabytesPerSecond << "gb/s \n";
 			}
 
+			if (result.allocationCount != 0 || result.peakLiveBytes != 0)
+			{
+				std::cout << "\tAllocations: " << result.allocationCount << " (" << result.bytesAllocated << " bytes) Peak live: " << result.peakLiveBytes << " bytes\n";
+			}
+
 			std::cout << "\n";
 		}
 
-		std::unordered_map<std::string, ProfileResult> results;
-		uint64_t totalTimeSampled = 0;
-		std::optional<uint64_t> activeProfileResultIndex = std::nullopt;
-		std::stack<std::string> profilerStack;
+		mutable std::mutex registrationMutex;
+		std::vector<AnchorTable> anchorTables;
+		uint32_t threadCount = 0;
+	};
+
+#if PROFILER_TRACE
+	// One scope begin or end, with the end flag in the low bit of lineAndEnd. The label is copied rather than read
+	// through the anchor, which its thread keeps writing. Fields are relaxed atomics so a flush can read a buffer the
+	// owning thread is still writing to
+	struct TraceEvent
+	{
+		std::atomic<uint64_t> timestamp;
+		std::atomic<char const*> label;
+		std::atomic<uint64_t> lineAndEnd;
+	};
+
+	// Per thread, a full buffer overwrites its oldest events so the trace always holds the most recent ones
+	constexpr uint64_t k_TraceEventsPerThread = 1 << 16;
+
+	// Single producer ring. The owning thread bumps reserved before writing an event and written after, a reader copies
+	// up to written and then drops anything reserved has since lapped, the same scheme as a seqlock
+	struct TraceBuffer
+	{
+		uint32_t threadIndex = 0;
+		std::atomic<uint64_t> reserved = 0;
+		std::atomic<uint64_t> written = 0;
+		std::unique_ptr<TraceEvent[]> events = std::make_unique<TraceEvent[]>(k_TraceEventsPerThread);
+	};
+
+	inline thread_local TraceBuffer* t_traceBuffer = nullptr;
+
+	// Owns every thread's trace buffer and writes them out as Chrome Trace Event JSON, which Perfetto and chrome://tracing
+	// open directly. Writes k_DefaultTracePath at exit unless WriteTrace was already called
+	class TraceRecorder
+	{
+	public:
+		static constexpr char const* k_DefaultTracePath = "profile_trace.json";
+
+		static TraceRecorder& Get()
+		{
+			static TraceRecorder instance;
+			return instance;
+		}
+
+		// Only called the first time a thread registers an anchor table
+		TraceBuffer* CreateThreadBuffer(uint32_t threadIndex)
+		{
+			std::lock_guard lock(mutex);
+			TraceBuffer& buffer = *buffers.emplace_back(std::make_unique<TraceBuffer>());
+			buffer.threadIndex = threadIndex;
+			return &buffer;
+		}
+
+		bool WriteTrace(char const* path)
+		{
+			std::lock_guard lock(mutex);
+			written = true;
+
+			std::ofstream file(path);
+			if (!file) return false;
+
+			std::vector<std::vector<RecordedEvent>> threadEvents;
+			uint64_t baseTimestamp = UINT64_MAX;
+			for (std::unique_ptr<TraceBuffer> const& buffer : buffers)
+			{
+				std::vector<RecordedEvent>& events = threadEvents.emplace_back(CopyEvents(*buffer));
+				if (!events.empty()) baseTimestamp = std::min(baseTimestamp, events.front().timestamp);
+			}
+
+			double microsecondsPerCycle = 1'000'000.0 / (double)CpuStats::Get().k_CpuFrequencyHz;
+			char const* separator = "\n";
+			file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+			for (size_t i = 0; i < buffers.size(); ++i)
+			{
+				uint32_t threadIndex = buffers[i]->threadIndex;
+				file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << threadIndex << ",\"args\":{\"name\":\"Thread " << threadIndex << "\"}}";
+				separator = ",\n";
+
+				// The oldest events may have been overwritten, skip ends whose begin is gone so the viewer does not pair them up wrongly
+				uint32_t depth = 0;
+				for (RecordedEvent const& event : threadEvents[i])
+				{
+					if (event.end)
+					{
+						if (depth == 0) continue;
+						--depth;
+					}
+					else
+					{
+						++depth;
+					}
+
+					file << separator << "{\"name\":\"";
+					WriteEscaped(file, event.label);
+					file << "\",\"ph\":\"" << (event.end ? 'E' : 'B') << "\",\"pid\":0,\"tid\":" << threadIndex
+						<< ",\"ts\":" << (double)(event.timestamp - baseTimestamp) * microsecondsPerCycle
+						<< ",\"args\":{\"line\":" << event.lineNumber << "}}";
+				}
+			}
+
+			file << "\n]}\n";
+			return (bool)file;
+		}
+
+	private:
+		struct RecordedEvent
+		{
+			uint64_t timestamp;
+			char const* label;
+			uint64_t lineNumber;
+			bool end;
+		};
+
+		// Constructed first so it is destroyed after this writes the trace at exit
+		TraceRecorder()
+		{
+			CpuStats::Get();
+		}
+
+		~TraceRecorder()
+		{
+			if (!written) WriteTrace(k_DefaultTracePath);
+		}
+
+		TraceRecorder(TraceRecorder const&) = delete;
+		TraceRecorder& operator=(TraceRecorder const&) = delete;
+
+		static std::vector<RecordedEvent> CopyEvents(TraceBuffer const& buffer)
+		{
+			uint64_t end = buffer.written.load(std::memory_order_acquire);
+			uint64_t begin = end > k_TraceEventsPerThread ? end - k_TraceEventsPerThread : 0;
+
+			std::vector<RecordedEvent> events;
+			events.reserve(end - begin);
+			for (uint64_t i = begin; i < end; ++i)
+			{
+				TraceEvent const& event = buffer.events[i % k_TraceEventsPerThread];
+				uint64_t lineAndEnd = event.lineAndEnd.load(std::memory_order_relaxed);
+				events.push_back({ event.timestamp.load(std::memory_order_relaxed), event.label.load(std::memory_order_relaxed), lineAndEnd >> 1, (lineAndEnd & 1) != 0 });
+			}
+
+			// Anything the writer started overwriting while we copied may be torn
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t reserved = buffer.reserved.load(std::memory_order_relaxed);
+			if (reserved > k_TraceEventsPerThread && reserved - k_TraceEventsPerThread > begin)
+			{
+				events.erase(events.begin(), events.begin() + (ptrdiff_t)std::min(reserved - k_TraceEventsPerThread - begin, (uint64_t)events.size()));
+			}
+
+			return events;
+		}
+
+		static void WriteEscaped(std::ostream& stream, char const* text)
+		{
+			for (; *text; ++text)
+			{
+				if (*text == '"' || *text == '\\') stream << '\\';
+				stream << *text;
+			}
+		}
+
+		std::mutex mutex;
+		std::vector<std::unique_ptr<TraceBuffer>> buffers;
+		bool written = false;
 	};
 
+	// Called with the registration lock held, the first time a thread creates an anchor table
+	inline void CreateThreadTraceBuffer()
+	{
+		if (t_traceBuffer == nullptr)
+		{
+			t_traceBuffer = TraceRecorder::Get().CreateThreadBuffer(t_threadIndex);
+		}
+	}
+
+	// Hot path, no allocation or formatting: a few plain stores into this thread's ring. Every anchor comes from an
+	// anchor table, so the thread's buffer already exists by the time a scope begins
+	inline void RecordTraceEvent(char const* label, int lineNumber, uint64_t timestamp, bool end)
+	{
+		TraceBuffer* buffer = t_traceBuffer;
+
+		uint64_t index = buffer->written.load(std::memory_order_relaxed);
+		buffer->reserved.store(index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		TraceEvent& event = buffer->events[index % k_TraceEventsPerThread];
+		event.timestamp.store(timestamp, std::memory_order_relaxed);
+		event.label.store(label, std::memory_order_relaxed);
+		event.lineAndEnd.store(((uint64_t)lineNumber << 1) | (uint64_t)end, std::memory_order_relaxed);
+		buffer->written.store(index + 1, std::memory_order_release);
+	}
+#endif // PROFILER_TRACE
+
+	// Every translation unit that includes this header gets its own per thread anchor table, indexed by __COUNTER__,
+	// so call sites in different translation units or on different threads never share a slot
+	namespace
+	{
+		thread_local ProfileResult* t_anchors = nullptr;
+
+		template<uint32_t AnchorIndex>
+		inline ProfileResult& GetAnchor()
+		{
+			static_assert(AnchorIndex < k_MaxAnchors, "Too many profiled scopes in this translation unit, increase k_MaxAnchors");
+			if (t_anchors == nullptr) [[unlikely]]
+			{
+				t_anchors = ProfilerResultsHolder::Get().CreateThreadAnchorTable(k_MaxAnchors);
+			}
+
+			return t_anchors[AnchorIndex];
+		}
+	}
 
 	class Profiler
 	{
 	public:
-		inline void Begin(const char* functionName, int lineNumber, uint64_t bytesProcessed)
+		inline void Begin(ProfileResult& anchor, const char* functionName, int lineNumber, uint64_t bytesProcessed)
 		{
-			resultLabel = std::string(functionName);
-			resultLabel += std::to_string(lineNumber);
+			result = &anchor;
+			result->label = functionName;
+			result->lineNumber = lineNumber;
+			result->bytesProcessed += bytesProcessed;
+
+			parent = t_activeAnchor;
+			t_activeAnchor = result;
 
-			ProfileResult* res = ProfilerResultsHolder::Get().GetResult(resultLabel);
-			res->bytesProcessed += bytesProcessed;
+#if PROFILER_TRACK_ALLOCATIONS
+			startLiveBytes = t_liveBytes;
+			parentPeakLiveBytes = t_peakLiveBytes;
+			t_peakLiveBytes = t_liveBytes;
+#endif
 
 			start = ReadCpuTimer();
-			ProfilerResultsHolder::Get().PushProfilerLabel(resultLabel);
+#if PROFILER_TRACE
+			RecordTraceEvent(functionName, lineNumber, start, false);
+#endif
 		}
 
 		inline void End() {
-			ProfileResult* res = ProfilerResultsHolder::Get().GetResult(resultLabel);
-			uint64_t elapsedTime = ReadCpuTimer() - start;
-			res->totalElapsedTime += elapsedTime;
-			res->rootElapsedTime = elapsedTime;
-			++res->hitCount;
-
-			if (auto oParentRes = ProfilerResultsHolder::Get().GetParentProfilerResult(); oParentRes)
+			uint64_t end = ReadCpuTimer();
+#if PROFILER_TRACE
+			RecordTraceEvent(result->label, result->lineNumber, end, true);
+#endif
+			uint64_t elapsedTime = end - start;
+			result->totalElapsedTime += elapsedTime;
+			result->rootElapsedTime = elapsedTime;
+			++result->hitCount;
+
+			if (parent)
 			{
-				ProfileResult* parentRes = *oParentRes;
-				parentRes->childrenTotalElapsedTime += elapsedTime;
+				parent->childrenTotalElapsedTime += elapsedTime;
 			}
 
-			ProfilerResultsHolder::Get().PopProfilerLabel();
+			t_activeAnchor = parent;
+
+#if PROFILER_TRACK_ALLOCATIONS
+			result->peakLiveBytes = std::max(result->peakLiveBytes, (uint64_t)(t_peakLiveBytes - startLiveBytes));
+			t_peakLiveBytes = std::max(parentPeakLiveBytes, t_peakLiveBytes);
+#endif
 		}
 
 		static void PrintResults()
@@ -309,19 +769,24 @@ namespace Profiler
 			ProfilerResultsHolder::Get().PrintResults();
 		}
 
-		inline ProfileResult const& GetResult() { return *ProfilerResultsHolder::Get().GetResult(resultLabel); }
+		inline ProfileResult const& GetResult() { return *result; }
 
 	private:
-		std::string resultLabel;
-		uint64_t start;
+		ProfileResult* result = nullptr;
+		ProfileResult* parent = nullptr;
+		uint64_t start = 0;
+#if PROFILER_TRACK_ALLOCATIONS
+		int64_t startLiveBytes = 0;
+		int64_t parentPeakLiveBytes = 0;
+#endif
 	};
 
 	class ScopedProfiler
 	{
 	public:
-		explicit ScopedProfiler(char const* functionName, int lineNumber, uint64_t bytesProcessed = 0)
+		explicit ScopedProfiler(ProfileResult& anchor, char const* functionName, int lineNumber, uint64_t bytesProcessed = 0)
 		{
-			profiler.Begin(functionName, lineNumber, bytesProcessed);
+			profiler.Begin(anchor, functionName, lineNumber, bytesProcessed);
 		}
 
 		~ScopedProfiler()
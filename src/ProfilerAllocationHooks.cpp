@@ -0,0 +1,79 @@
+// Replaces the global operator new and delete so every heap allocation is attributed to the innermost running profile
+// scope. Only compiled in when configured with PROFILER_TRACK_ALLOCATIONS, the header in front of each allocation and the
+// thread local bookkeeping slow every allocation down.
+#if PROFILER_TRACK_ALLOCATIONS
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "Profiler.h"
+
+namespace
+{
+	// Stored just in front of each allocation, so delete knows the size even when the caller does not pass it
+	struct AllocationHeader
+	{
+		void* base;
+		size_t size;
+	};
+
+	void* TrackedAllocate(size_t size, size_t alignment)
+	{
+		alignment = std::max(alignment, alignof(std::max_align_t));
+		void* base = std::malloc(size + sizeof(AllocationHeader) + alignment);
+		if (!base) throw std::bad_alloc();
+
+		uintptr_t address = ((uintptr_t)base + sizeof(AllocationHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		AllocationHeader* header = (AllocationHeader*)address - 1;
+		header->base = base;
+		header->size = size;
+
+		Profiler::RecordAllocation(size);
+		return (void*)address;
+	}
+
+	void TrackedFree(void* pointer)
+	{
+		if (!pointer) return;
+
+		AllocationHeader* header = (AllocationHeader*)pointer - 1;
+		Profiler::RecordFree(header->size);
+		std::free(header->base);
+	}
+}
+
+// The array and nothrow forms forward to these by default. The sized deletes are replaced too rather than left to the
+// library's fallback, the size they are passed is ignored in favour of the header
+void* operator new(size_t size)
+{
+	return TrackedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	return TrackedAllocate(size, (size_t)alignment);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+	TrackedFree(pointer);
+}
+
+#endif // PROFILER_TRACK_ALLOCATIONS
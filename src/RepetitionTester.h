@@ -1,8 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <string>
 #include <iostream>
+#include <vector>
 #include "Profiler.h"
+#include "HardwareCounters.h"
 
 //Requirements
 // Enable the running of a set of code repeatedly
@@ -26,6 +30,70 @@ struct TestResult
 	uint64_t minPageFaults = 0;
 	uint64_t maxPageFaults = 0;
 	uint64_t totalPageFaults = 0;
+
+	// Indexed the same as RepetitionTester::GetHardwareCounters(), min and max are tracked per counter
+	uint64_t minCounters[k_MaxHardwareCounters] = {};
+	uint64_t maxCounters[k_MaxHardwareCounters] = {};
+	uint64_t totalCounters[k_MaxHardwareCounters] = {};
+	uint32_t counterTestCount = 0;
+};
+
+// Distribution of test durations in clock cycles, calculated from the stored samples
+struct SampleStats
+{
+	uint64_t sampleCount = 0;
+	uint64_t trimmedCount = 0; // Outliers excluded from every other field
+	double mean = 0.0;
+	double stdDev = 0.0;
+	double median = 0.0;
+	double medianAbsoluteDeviation = 0.0;
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+};
+
+// Everything reported for a finished test, kept so results can be exported once the whole suite has run
+struct TestSummary
+{
+	std::string testName;
+	uint64_t testCount = 0;
+	uint64_t bytesPerTest = 0;
+	uint64_t minClockCycles = 0;
+	uint64_t maxClockCycles = 0;
+	uint64_t avgClockCycles = 0;
+	uint64_t minPageFaults = 0;
+	uint64_t maxPageFaults = 0;
+	uint64_t avgPageFaults = 0;
+	SampleStats stats;
+};
+
+class RepetitionResultsHolder
+{
+public:
+	static RepetitionResultsHolder& Get()
+	{
+		static RepetitionResultsHolder instance;
+		return instance;
+	}
+
+	void Record(TestSummary const& summary)
+	{
+		summaries.push_back(summary);
+	}
+
+	std::vector<TestSummary> const& GetSummaries() const
+	{
+		return summaries;
+	}
+
+private:
+	RepetitionResultsHolder() = default;
+
+	RepetitionResultsHolder(RepetitionResultsHolder const&) = delete;
+	RepetitionResultsHolder& operator=(RepetitionResultsHolder const&) = delete;
+
+	std::vector<TestSummary> summaries;
 };
 
 struct CurrentTestStats
@@ -35,11 +103,24 @@ struct CurrentTestStats
 	uint64_t startTime = 0;
 };
 
+enum class TestStopRule
+{
+	NoNewMin, // No new min clock cycles for numSecondsToFindNewResult
+	ConfidenceInterval // Mean has converged to within targetRelativeError
+};
+
 struct TestParameters
 {
 	uint64_t expectedBytesToProcessPerTest;
 	std::string testName;
 	uint32_t numSecondsToFindNewResult;
+	std::vector<HardwareCounter> hardwareCounters = {}; // Empty to skip reading hardware counters
+	uint32_t maxSamples = 1 << 16; // Preallocated, once full a uniform random subset of all samples is kept
+	double outlierMadThreshold = 0.0; // Trim samples this many (normal scaled) MADs from the median when reporting, 0 keeps all
+	TestStopRule stopRule = TestStopRule::NoNewMin;
+	double targetRelativeError = 0.01; // ConfidenceInterval: stop once the 95% interval of the mean is within this fraction of it
+	uint32_t minSamplesToConverge = 30;
+	uint32_t maxSecondsToConverge = 60; // ConfidenceInterval: give up on noisy tests after this much tested time
 };
 
 enum class RepetitionTesterState
@@ -54,8 +135,10 @@ class RepetitionTester
 public:
 	explicit RepetitionTester(TestParameters const& testParams)
 		: params(testParams)
+		, counters(testParams.hardwareCounters)
 	{
 		currentTest.bytesProcessed = testParams.expectedBytesToProcessPerTest;
+		samples.reserve(testParams.maxSamples);
 	}
 
 	void BeginTest()
@@ -64,7 +147,8 @@ public:
 		++result.startTestCount;
 
 		currentTest.bytesProcessed = 0;
-		currentTest.startPageFaults = result.totalPageFaults;
+		currentTest.startPageFaults = Profiler::OsStats::Get().GetPageFaults();
+		counters.Start();
 		currentTest.startTime = Profiler::ReadCpuTimer();
 	}
 
@@ -72,6 +156,8 @@ public:
 	{
 		uint64_t currentTestEndTime = Profiler::ReadCpuTimer();
 		uint64_t currentTestDuration = currentTestEndTime - currentTest.startTime;
+		HardwareCounterValues counterValues;
+		bool hasCounterValues = counters.Stop(counterValues);
 		uint64_t currentTestEndPageFaults = Profiler::OsStats::Get().GetPageFaults();
 		uint64_t currentTestPageFaults = currentTestEndPageFaults - currentTest.startPageFaults;
 
@@ -84,6 +170,7 @@ public:
 		currentTest.startPageFaults = 0;
 
 		++result.completeTestCount;
+		RecordSample(currentTestDuration);
 
 		if (currentTestDuration < result.minClockCycles)
 		{
@@ -101,6 +188,11 @@ public:
 			result.maxBytes = currentTest.bytesProcessed;
 			result.maxPageFaults = currentTestPageFaults;
 		}
+
+		if (hasCounterValues)
+		{
+			RecordCounters(counterValues);
+		}
 	}
 
 	void PushError(std::string const& errorMessage)
@@ -123,10 +215,25 @@ public:
 				PushError("Processed bytes mismatched");
 			}
 
-			uint64_t secondsSinceMinUpdated = clockCyclesSinceMinUpdated / Profiler::CpuStats::Get().k_CpuFrequencyHz;
-			if (secondsSinceMinUpdated >= params.numSecondsToFindNewResult)
+			if (params.stopRule == TestStopRule::ConfidenceInterval)
+			{
+				if (HasConverged())
+				{
+					state = RepetitionTesterState::Finished;
+				}
+			}
+			else
+			{
+				uint64_t secondsSinceMinUpdated = clockCyclesSinceMinUpdated / Profiler::CpuStats::Get().k_CpuFrequencyHz;
+				if (secondsSinceMinUpdated >= params.numSecondsToFindNewResult)
+				{
+					state = RepetitionTesterState::Finished;
+				}
+			}
+
+			if (state == RepetitionTesterState::Finished)
 			{
-				state = RepetitionTesterState::Finished;
+				RepetitionResultsHolder::Get().Record(GetSummary());
 			}
 		}
 
@@ -172,12 +279,221 @@ public:
 		uint64_t avgCycles = result.totalClockCycles / result.completeTestCount;
 		uint64_t avgFaults = result.totalPageFaults / result.completeTestCount;
 		PrintTime("avg", avgCycles, bytesPerTest, avgFaults);
+
+		SampleStats stats = CalculateSampleStats();
+		if (stats.sampleCount != 0)
+		{
+			std::cout << "\t";
+			PrintTime("p50", stats.p50, bytesPerTest, 0);
+			std::cout << "\t";
+			PrintTime("p90", stats.p90, bytesPerTest, 0);
+			std::cout << "\t";
+			PrintTime("p99", stats.p99, bytesPerTest, 0);
+			std::cout << "\t";
+			PrintTime("p999", stats.p999, bytesPerTest, 0);
+
+			double cpuFreq = (double)Profiler::CpuStats::Get().k_CpuFrequencyHz;
+			std::cout << "\tstddev: " << stats.stdDev / cpuFreq << "s MAD: " << stats.medianAbsoluteDeviation / cpuFreq << "s";
+			std::cout << " (" << stats.sampleCount << " samples";
+			if (stats.trimmedCount != 0)
+			{
+				std::cout << ", " << stats.trimmedCount << " outliers trimmed";
+			}
+			std::cout << ")\n";
+		}
+
+		PrintCounters();
 	}
 
+	// Sorts a copy of the samples, so only call this once testing has finished
+	SampleStats CalculateSampleStats() const
+	{
+		SampleStats stats;
+		if (samples.empty()) return stats;
+
+		std::vector<uint64_t> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		double median = Median(sorted);
+		double mad = MedianAbsoluteDeviation(sorted, median);
+
+		if (params.outlierMadThreshold > 0.0 && mad > 0.0)
+		{
+			// 1.4826 scales the MAD to match the standard deviation of normally distributed samples
+			double maxDeviation = params.outlierMadThreshold * 1.4826 * mad;
+			std::erase_if(sorted, [=](uint64_t sample) { return std::abs((double)sample - median) > maxDeviation; });
+			stats.trimmedCount = samples.size() - sorted.size();
+
+			median = Median(sorted);
+			mad = MedianAbsoluteDeviation(sorted, median);
+		}
+
+		double sum = 0.0;
+		for (uint64_t sample : sorted)
+		{
+			sum += (double)sample;
+		}
+		double mean = sum / (double)sorted.size();
+
+		double squaredDeviations = 0.0;
+		for (uint64_t sample : sorted)
+		{
+			squaredDeviations += ((double)sample - mean) * ((double)sample - mean);
+		}
+
+		stats.sampleCount = sorted.size();
+		stats.mean = mean;
+		stats.stdDev = sorted.size() > 1 ? std::sqrt(squaredDeviations / (double)(sorted.size() - 1)) : 0.0;
+		stats.median = median;
+		stats.medianAbsoluteDeviation = mad;
+		stats.p50 = Percentile(sorted, 0.5);
+		stats.p90 = Percentile(sorted, 0.9);
+		stats.p99 = Percentile(sorted, 0.99);
+		stats.p999 = Percentile(sorted, 0.999);
+
+		return stats;
+	}
+
+	std::vector<uint64_t> const& GetSamples() const { return samples; }
+
+	TestSummary GetSummary() const
+	{
+		TestSummary summary;
+		summary.testName = params.testName;
+		summary.testCount = result.completeTestCount;
+		if (result.completeTestCount == 0) return summary;
+
+		summary.bytesPerTest = result.totalBytes / result.completeTestCount;
+		summary.minClockCycles = result.minClockCycles;
+		summary.maxClockCycles = result.maxClockCycles;
+		summary.avgClockCycles = result.totalClockCycles / result.completeTestCount;
+		summary.minPageFaults = result.minPageFaults;
+		summary.maxPageFaults = result.maxPageFaults;
+		summary.avgPageFaults = result.totalPageFaults / result.completeTestCount;
+		summary.stats = CalculateSampleStats();
+
+		return summary;
+	}
+
+	std::vector<HardwareCounter> const& GetHardwareCounters() const { return counters.GetCounters(); }
+
 private:
+	void RecordSample(uint64_t clockCycles)
+	{
+		// Welford's running variance, over every test so convergence does not depend on the sample buffer size
+		double delta = (double)clockCycles - runningMean;
+		runningMean += delta / (double)result.completeTestCount;
+		runningSquaredDeviations += delta * ((double)clockCycles - runningMean);
+
+		if (samples.size() < params.maxSamples)
+		{
+			samples.push_back(clockCycles);
+			return;
+		}
+
+		// Reservoir sampling, every test has the same chance of being kept
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 7;
+		randomState ^= randomState << 17;
+		uint64_t replaceIndex = randomState % result.completeTestCount;
+		if (replaceIndex < samples.size())
+		{
+			samples[replaceIndex] = clockCycles;
+		}
+	}
+
+	bool HasConverged() const
+	{
+		uint64_t testedSeconds = result.totalClockCycles / Profiler::CpuStats::Get().k_CpuFrequencyHz;
+		if (testedSeconds >= params.maxSecondsToConverge) return true;
+
+		uint64_t count = result.completeTestCount;
+		if (count < params.minSamplesToConverge || count < 2 || runningMean <= 0.0) return false;
+
+		double stdDev = std::sqrt(runningSquaredDeviations / (double)(count - 1));
+		double confidenceHalfWidth = 1.96 * stdDev / std::sqrt((double)count);
+		return confidenceHalfWidth / runningMean <= params.targetRelativeError;
+	}
+
+	static double Median(std::vector<uint64_t> const& sorted)
+	{
+		if (sorted.empty()) return 0.0;
+
+		size_t middle = sorted.size() / 2;
+		if (sorted.size() % 2 == 0)
+		{
+			return ((double)sorted[middle - 1] + (double)sorted[middle]) / 2.0;
+		}
+
+		return (double)sorted[middle];
+	}
+
+	static double MedianAbsoluteDeviation(std::vector<uint64_t> const& sorted, double median)
+	{
+		std::vector<uint64_t> deviations;
+		deviations.reserve(sorted.size());
+		for (uint64_t sample : sorted)
+		{
+			deviations.push_back((uint64_t)std::llround(std::abs((double)sample - median)));
+		}
+		std::sort(deviations.begin(), deviations.end());
+
+		return Median(deviations);
+	}
+
+	// Nearest rank percentile
+	static uint64_t Percentile(std::vector<uint64_t> const& sorted, double percentile)
+	{
+		size_t rank = (size_t)std::ceil(percentile * (double)sorted.size());
+		return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+	}
+
+	void RecordCounters(HardwareCounterValues const& counterValues)
+	{
+		bool firstSample = result.counterTestCount == 0;
+		++result.counterTestCount;
+
+		for (uint32_t i = 0; i < counterValues.count; ++i)
+		{
+			uint64_t value = counterValues.values[i];
+			result.totalCounters[i] += value;
+
+			if (firstSample || value < result.minCounters[i]) result.minCounters[i] = value;
+			if (value > result.maxCounters[i]) result.maxCounters[i] = value;
+		}
+	}
+
+	void PrintCounters() const
+	{
+		if (result.counterTestCount == 0) return;
+
+		std::vector<HardwareCounter> const& counterTypes = counters.GetCounters();
+		uint64_t instructions = 0;
+		uint64_t coreCycles = 0;
+
+		for (uint32_t i = 0; i < counterTypes.size(); ++i)
+		{
+			uint64_t avgCount = result.totalCounters[i] / result.counterTestCount;
+			std::cout << "\t" << GetHardwareCounterName(counterTypes[i]) << ": min " << result.minCounters[i] << " max " << result.maxCounters[i] << " avg " << avgCount << "\n";
+
+			if (counterTypes[i] == HardwareCounter::Instructions) instructions = result.totalCounters[i];
+			if (counterTypes[i] == HardwareCounter::CoreCycles) coreCycles = result.totalCounters[i];
+		}
+
+		if (instructions != 0 && coreCycles != 0)
+		{
+			std::cout << "\tIPC: " << (double)instructions / (double)coreCycles << "\n";
+		}
+	}
+
 	TestParameters params;
 	TestResult result;
 	CurrentTestStats currentTest;
+	HardwareCounters counters;
+
+	std::vector<uint64_t> samples;
+	double runningMean = 0.0;
+	double runningSquaredDeviations = 0.0;
+	uint64_t randomState = 0x9E3779B97F4A7C15ull;
 
 	uint64_t clockCyclesSinceMinUpdated = 0;
 	RepetitionTesterState state = RepetitionTesterState::Executing;
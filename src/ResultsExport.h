@@ -0,0 +1,294 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Profiler.h"
+#include "RepetitionTester.h"
+
+//Writes every profiler anchor and finished repetition test as JSON or CSV so results can be tracked between builds.
+//A CSV written by a previous run can be loaded back as a baseline, and tests whose min or median time regressed
+//past a threshold are reported. Times are exported in seconds as well as cycles, baselines are compared in seconds
+//so they remain valid between machines with different TSC frequencies.
+
+namespace ResultsExport
+{
+	inline double CyclesToSeconds(double clockCycles)
+	{
+		return clockCycles / (double)Profiler::CpuStats::Get().k_CpuFrequencyHz;
+	}
+
+	inline double GigabytesPerSecond(uint64_t bytes, double clockCycles)
+	{
+		double seconds = CyclesToSeconds(clockCycles);
+		if (bytes == 0 || seconds <= 0.0) return 0.0;
+
+		return (double)bytes / seconds / (1024.0 * 1024.0 * 1024.0);
+	}
+
+	inline std::string JsonString(std::string const& value)
+	{
+		std::string escaped = "\"";
+		for (char c : value)
+		{
+			switch (c)
+			{
+			case '"': escaped += "\\\""; break;
+			case '\\': escaped += "\\\\"; break;
+			case '\n': escaped += "\\n"; break;
+			case '\t': escaped += "\\t"; break;
+			default: escaped += c; break;
+			}
+		}
+
+		return escaped + "\"";
+	}
+
+	inline std::string CsvString(std::string const& value)
+	{
+		std::string escaped = "\"";
+		for (char c : value)
+		{
+			escaped += c;
+			if (c == '"') escaped += '"';
+		}
+
+		return escaped + "\"";
+	}
+
+	inline std::string GetProfileLabel(Profiler::ProfileResult const& result)
+	{
+		return std::string(result.label) + std::to_string(result.lineNumber);
+	}
+
+	inline void WriteJson(std::ostream& out)
+	{
+		std::vector<Profiler::ProfileResult> profileResults = Profiler::ProfilerResultsHolder::Get().MergeResults(0);
+		std::vector<TestSummary> const& summaries = RepetitionResultsHolder::Get().GetSummaries();
+
+		out << "{\n";
+		out << "\t\"cpuFrequencyHz\": " << Profiler::CpuStats::Get().k_CpuFrequencyHz << ",\n";
+
+		out << "\t\"profile\": [";
+		for (size_t i = 0; i < profileResults.size(); ++i)
+		{
+			Profiler::ProfileResult const& result = profileResults[i];
+			out << (i == 0 ? "\n" : ",\n");
+			out << "\t\t{ \"label\": " << JsonString(GetProfileLabel(result))
+				<< ", \"hitCount\": " << result.hitCount
+				<< ", \"exclusiveCycles\": " << result.ChildExclusiveDuration()
+				<< ", \"inclusiveCycles\": " << result.totalElapsedTime
+				<< ", \"exclusiveSeconds\": " << CyclesToSeconds((double)result.ChildExclusiveDuration())
+				<< ", \"inclusiveSeconds\": " << CyclesToSeconds((double)result.totalElapsedTime)
+				<< ", \"bytesProcessed\": " << result.bytesProcessed
+				<< ", \"gigabytesPerSecond\": " << GigabytesPerSecond(result.bytesProcessed, (double)result.totalElapsedTime)
+				<< " }";
+		}
+		out << "\n\t],\n";
+
+		out << "\t\"repetitionTests\": [";
+		for (size_t i = 0; i < summaries.size(); ++i)
+		{
+			TestSummary const& summary = summaries[i];
+			out << (i == 0 ? "\n" : ",\n");
+			out << "\t\t{ \"name\": " << JsonString(summary.testName)
+				<< ", \"testCount\": " << summary.testCount
+				<< ", \"bytesPerTest\": " << summary.bytesPerTest
+				<< ", \"minCycles\": " << summary.minClockCycles
+				<< ", \"maxCycles\": " << summary.maxClockCycles
+				<< ", \"avgCycles\": " << summary.avgClockCycles
+				<< ", \"medianCycles\": " << summary.stats.median
+				<< ", \"p90Cycles\": " << summary.stats.p90
+				<< ", \"p99Cycles\": " << summary.stats.p99
+				<< ", \"p999Cycles\": " << summary.stats.p999
+				<< ", \"stdDevCycles\": " << summary.stats.stdDev
+				<< ", \"madCycles\": " << summary.stats.medianAbsoluteDeviation
+				<< ", \"minSeconds\": " << CyclesToSeconds((double)summary.minClockCycles)
+				<< ", \"medianSeconds\": " << CyclesToSeconds(summary.stats.median)
+				<< ", \"minGigabytesPerSecond\": " << GigabytesPerSecond(summary.bytesPerTest, (double)summary.minClockCycles)
+				<< ", \"medianGigabytesPerSecond\": " << GigabytesPerSecond(summary.bytesPerTest, summary.stats.median)
+				<< ", \"minPageFaults\": " << summary.minPageFaults
+				<< ", \"maxPageFaults\": " << summary.maxPageFaults
+				<< ", \"avgPageFaults\": " << summary.avgPageFaults
+				<< " }";
+		}
+		out << "\n\t]\n";
+		out << "}\n";
+	}
+
+	// One row per profiler anchor or repetition test, columns that do not apply to a kind are left empty
+	inline void WriteCsv(std::ostream& out)
+	{
+		out << "kind,name,count,exclusive_cycles,inclusive_cycles,min_cycles,max_cycles,avg_cycles,median_cycles,p90_cycles,p99_cycles,p999_cycles,"
+			"stddev_cycles,mad_cycles,min_seconds,median_seconds,bytes,gigabytes_per_second,min_page_faults,max_page_faults,avg_page_faults\n";
+
+		for (Profiler::ProfileResult const& result : Profiler::ProfilerResultsHolder::Get().MergeResults(0))
+		{
+			out << "profile," << CsvString(GetProfileLabel(result)) << "," << result.hitCount << ","
+				<< result.ChildExclusiveDuration() << "," << result.totalElapsedTime << ",,,,,,,,,,,,"
+				<< result.bytesProcessed << "," << GigabytesPerSecond(result.bytesProcessed, (double)result.totalElapsedTime) << ",,,\n";
+		}
+
+		for (TestSummary const& summary : RepetitionResultsHolder::Get().GetSummaries())
+		{
+			out << "repetition," << CsvString(summary.testName) << "," << summary.testCount << ",,,"
+				<< summary.minClockCycles << "," << summary.maxClockCycles << "," << summary.avgClockCycles << ","
+				<< summary.stats.median << "," << summary.stats.p90 << "," << summary.stats.p99 << "," << summary.stats.p999 << ","
+				<< summary.stats.stdDev << "," << summary.stats.medianAbsoluteDeviation << ","
+				<< CyclesToSeconds((double)summary.minClockCycles) << "," << CyclesToSeconds(summary.stats.median) << ","
+				<< summary.bytesPerTest << "," << GigabytesPerSecond(summary.bytesPerTest, (double)summary.minClockCycles) << ","
+				<< summary.minPageFaults << "," << summary.maxPageFaults << "," << summary.avgPageFaults << "\n";
+		}
+	}
+
+	inline bool WriteFile(std::string const& path, void (*writer)(std::ostream&))
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			std::cout << "Unable to write results to " << path << "\n";
+			return false;
+		}
+
+		writer(file);
+		return true;
+	}
+
+	struct BaselineEntry
+	{
+		std::string name;
+		double minSeconds = 0.0;
+		double medianSeconds = 0.0;
+	};
+
+	inline std::vector<std::string> SplitCsvLine(std::string const& line)
+	{
+		std::vector<std::string> fields(1);
+		bool quoted = false;
+		for (size_t i = 0; i < line.size(); ++i)
+		{
+			char c = line[i];
+			if (quoted)
+			{
+				if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+				{
+					fields.back() += '"';
+					++i;
+				}
+				else if (c == '"')
+				{
+					quoted = false;
+				}
+				else
+				{
+					fields.back() += c;
+				}
+			}
+			else if (c == '"')
+			{
+				quoted = true;
+			}
+			else if (c == ',')
+			{
+				fields.emplace_back();
+			}
+			else if (c != '\r')
+			{
+				fields.back() += c;
+			}
+		}
+
+		return fields;
+	}
+
+	// Reads the repetition tests from a CSV written by WriteCsv
+	inline std::vector<BaselineEntry> LoadBaselineCsv(std::string const& path)
+	{
+		std::vector<BaselineEntry> baseline;
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "Unable to read baseline " << path << "\n";
+			return baseline;
+		}
+
+		std::string line;
+		std::getline(file, line);
+		std::vector<std::string> header = SplitCsvLine(line);
+		auto column = [&](std::string const& name) -> size_t {
+			for (size_t i = 0; i < header.size(); ++i)
+			{
+				if (header[i] == name) return i;
+			}
+			return header.size();
+		};
+		size_t kindColumn = column("kind");
+		size_t nameColumn = column("name");
+		size_t minColumn = column("min_seconds");
+		size_t medianColumn = column("median_seconds");
+
+		while (std::getline(file, line))
+		{
+			std::vector<std::string> fields = SplitCsvLine(line);
+			if (kindColumn >= fields.size() || fields[kindColumn] != "repetition") continue;
+			if (nameColumn >= fields.size() || minColumn >= fields.size() || medianColumn >= fields.size()) continue;
+
+			BaselineEntry entry;
+			entry.name = fields[nameColumn];
+			entry.minSeconds = std::strtod(fields[minColumn].c_str(), nullptr);
+			entry.medianSeconds = std::strtod(fields[medianColumn].c_str(), nullptr);
+			baseline.push_back(entry);
+		}
+
+		return baseline;
+	}
+
+	struct Regression
+	{
+		std::string name;
+		std::string metric;
+		double baselineSeconds = 0.0;
+		double currentSeconds = 0.0;
+
+		double RelativeChange() const { return currentSeconds / baselineSeconds - 1.0; }
+	};
+
+	// Flags tests whose min or median time grew by more than threshold (0.05 = 5% slower), tests missing from either side are ignored
+	inline std::vector<Regression> CompareToBaseline(std::vector<BaselineEntry> const& baseline, double threshold)
+	{
+		std::vector<Regression> regressions;
+		for (TestSummary const& summary : RepetitionResultsHolder::Get().GetSummaries())
+		{
+			for (BaselineEntry const& entry : baseline)
+			{
+				if (entry.name != summary.testName) continue;
+
+				double currentMin = CyclesToSeconds((double)summary.minClockCycles);
+				double currentMedian = CyclesToSeconds(summary.stats.median);
+				if (entry.minSeconds > 0.0 && currentMin > entry.minSeconds * (1.0 + threshold))
+				{
+					regressions.push_back({ summary.testName, "min", entry.minSeconds, currentMin });
+				}
+
+				if (entry.medianSeconds > 0.0 && currentMedian > entry.medianSeconds * (1.0 + threshold))
+				{
+					regressions.push_back({ summary.testName, "median", entry.medianSeconds, currentMedian });
+				}
+			}
+		}
+
+		return regressions;
+	}
+
+	inline void PrintRegressions(std::vector<Regression> const& regressions)
+	{
+		for (Regression const& regression : regressions)
+		{
+			std::cout << "Regression: " << regression.name << " " << regression.metric << " " << regression.baselineSeconds << "s -> "
+				<< regression.currentSeconds << "s (+" << 100.0 * regression.RelativeChange() << "%)\n";
+		}
+	}
+
+} // namespace ResultsExport
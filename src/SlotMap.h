@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Values stored densely in one array, referenced through 32 bit handles instead of pointers. A handle is a slot index plus
+// the generation of that slot when the value was inserted, erasing bumps the generation so stale handles resolve to nullptr
+// instead of whatever was inserted into the slot next. Insert, erase and lookup are O(1), erase moves the last value into the
+// hole so the values stay dense and can be iterated without skipping anything. Iteration order changes on erase.
+
+template<typename T>
+class SlotMap
+{
+public:
+	static constexpr uint32_t k_indexBits = 24;
+	static constexpr uint32_t k_maxSlots = 1u << k_indexBits;
+
+	struct Handle
+	{
+		uint32_t value = UINT32_MAX;
+
+		uint32_t Index() const { return value & (k_maxSlots - 1); }
+		uint32_t Generation() const { return value >> k_indexBits; }
+		bool operator==(Handle const&) const = default;
+	};
+
+	static constexpr Handle k_invalidHandle = {};
+
+	// Returns k_invalidHandle once every slot index has been handed out
+	Handle Insert(T value)
+	{
+		uint32_t slotIndex;
+		if (freeHead != k_endOfFreeList)
+		{
+			slotIndex = freeHead;
+			freeHead = slots[slotIndex].denseIndexOrNextFree;
+		}
+		else
+		{
+			if (slots.size() == k_maxSlots) return k_invalidHandle;
+			slotIndex = (uint32_t)slots.size();
+			slots.push_back({});
+		}
+
+		Slot& slot = slots[slotIndex];
+		slot.denseIndexOrNextFree = (uint32_t)values.size();
+		values.push_back(std::move(value));
+		denseToSlot.push_back(slotIndex);
+
+		return Handle{ (slot.generation << k_indexBits) | slotIndex };
+	}
+
+	bool Erase(Handle handle)
+	{
+		if (!IsValid(handle)) return false;
+
+		// Move the last value into the hole and point its slot at the new position
+		Slot& slot = slots[handle.Index()];
+		uint32_t denseIndex = slot.denseIndexOrNextFree;
+		uint32_t lastIndex = (uint32_t)values.size() - 1;
+		if (denseIndex != lastIndex)
+		{
+			values[denseIndex] = std::move(values[lastIndex]);
+			denseToSlot[denseIndex] = denseToSlot[lastIndex];
+			slots[denseToSlot[denseIndex]].denseIndexOrNextFree = denseIndex;
+		}
+
+		values.pop_back();
+		denseToSlot.pop_back();
+
+		// A slot whose generation would wrap is retired rather than risk an old handle matching again
+		++slot.generation;
+		if (slot.generation < k_maxGeneration)
+		{
+			slot.denseIndexOrNextFree = freeHead;
+			freeHead = handle.Index();
+		}
+
+		return true;
+	}
+
+	T* Get(Handle handle)
+	{
+		return IsValid(handle) ? &values[slots[handle.Index()].denseIndexOrNextFree] : nullptr;
+	}
+
+	T const* Get(Handle handle) const
+	{
+		return IsValid(handle) ? &values[slots[handle.Index()].denseIndexOrNextFree] : nullptr;
+	}
+
+	bool IsValid(Handle handle) const
+	{
+		return handle.Index() < slots.size()
+			&& slots[handle.Index()].generation == handle.Generation()
+			&& handle.Generation() < k_maxGeneration;
+	}
+
+	void Reserve(size_t count)
+	{
+		values.reserve(count);
+		denseToSlot.reserve(count);
+		slots.reserve(count);
+	}
+
+	size_t Size() const { return values.size(); }
+
+	std::span<T> Values() { return values; }
+	std::span<T const> Values() const { return values; }
+
+	auto begin() { return values.begin(); }
+	auto end() { return values.end(); }
+	auto begin() const { return values.begin(); }
+	auto end() const { return values.end(); }
+
+private:
+	static constexpr uint32_t k_maxGeneration = (1u << (32 - k_indexBits)) - 1; // the all ones generation is k_invalidHandle
+	static constexpr uint32_t k_endOfFreeList = UINT32_MAX;
+
+	// A live slot holds the position of its value, a free slot holds the next free slot
+	struct Slot
+	{
+		uint32_t denseIndexOrNextFree = 0;
+		uint32_t generation = 0;
+	};
+
+	std::vector<T> values;
+	std::vector<uint32_t> denseToSlot;
+	std::vector<Slot> slots;
+	uint32_t freeHead = k_endOfFreeList;
+};
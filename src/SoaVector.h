@@ -0,0 +1,230 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Structure of arrays storage derived from a plain aggregate, so a layout experiment is a change to the struct instead of a
+// hand written parallel struct and new search code. The fields are found at compile time by counting how many initializers
+// the aggregate accepts and unpacking it with a structured binding, so this needs no macros or registration, but only works
+// for aggregates with up to 8 fields, no base classes and no C arrays. Nested aggregates stay one column, flatten them into
+// the outer struct to split their fields into hot and cold columns.
+// SoaVector: one std::vector per field
+// AosoaVector: tiles of TileWidth elements, each tile holding a short array per field, so a tile's fields share a few cache lines
+
+namespace Reflection
+{
+	// Converts to anything, used to probe how many initializers an aggregate takes
+	struct AnyField
+	{
+		template<typename T>
+		operator T() const;
+	};
+
+	template<typename T, typename... Fields>
+	constexpr size_t CountFields()
+	{
+		if constexpr (requires { T{ Fields{}..., AnyField{} }; })
+		{
+			return CountFields<T, Fields..., AnyField>();
+		}
+		else
+		{
+			return sizeof...(Fields);
+		}
+	}
+
+	template<typename T>
+	constexpr size_t k_fieldCount = CountFields<std::remove_cv_t<T>>();
+
+	// References to each field of value in declaration order
+	template<typename T>
+	constexpr auto Tie(T& value)
+	{
+		constexpr size_t count = k_fieldCount<T>;
+		static_assert(count >= 1 && count <= 8, "Only aggregates with 1 to 8 fields are supported");
+
+		if constexpr (count == 1) { auto& [f0] = value; return std::tie(f0); }
+		else if constexpr (count == 2) { auto& [f0, f1] = value; return std::tie(f0, f1); }
+		else if constexpr (count == 3) { auto& [f0, f1, f2] = value; return std::tie(f0, f1, f2); }
+		else if constexpr (count == 4) { auto& [f0, f1, f2, f3] = value; return std::tie(f0, f1, f2, f3); }
+		else if constexpr (count == 5) { auto& [f0, f1, f2, f3, f4] = value; return std::tie(f0, f1, f2, f3, f4); }
+		else if constexpr (count == 6) { auto& [f0, f1, f2, f3, f4, f5] = value; return std::tie(f0, f1, f2, f3, f4, f5); }
+		else if constexpr (count == 7) { auto& [f0, f1, f2, f3, f4, f5, f6] = value; return std::tie(f0, f1, f2, f3, f4, f5, f6); }
+		else { auto& [f0, f1, f2, f3, f4, f5, f6, f7] = value; return std::tie(f0, f1, f2, f3, f4, f5, f6, f7); }
+	}
+
+	template<typename Tuple>
+	struct RemoveReferences;
+
+	template<typename... Fields>
+	struct RemoveReferences<std::tuple<Fields...>>
+	{
+		using Type = std::tuple<std::remove_cvref_t<Fields>...>;
+	};
+
+	// std::tuple of the field types of T
+	template<typename T>
+	using FieldTypes = typename RemoveReferences<decltype(Tie(std::declval<T&>()))>::Type;
+
+	// Wrapper<Field>... for every field of T, e.g. a std::tuple of std::vectors
+	template<template<typename...> typename Wrapper, typename Tuple>
+	struct WrapFields;
+
+	template<template<typename...> typename Wrapper, typename... Fields>
+	struct WrapFields<Wrapper, std::tuple<Fields...>>
+	{
+		using Type = std::tuple<Wrapper<Fields>...>;
+	};
+
+	template<typename T, typename Fn>
+	constexpr void ForEachField(Fn const& fn)
+	{
+		[&]<size_t... I>(std::index_sequence<I...>) { (fn(std::integral_constant<size_t, I>{}), ...); }(std::make_index_sequence<k_fieldCount<T>>{});
+	}
+
+} // namespace Reflection
+
+template<typename T>
+class SoaVector
+{
+public:
+	static_assert(std::is_aggregate_v<T>, "SoaVector needs an aggregate to split into columns");
+
+	static constexpr size_t k_fieldCount = Reflection::k_fieldCount<T>;
+
+	template<size_t Field>
+	using FieldType = std::tuple_element_t<Field, Reflection::FieldTypes<T>>;
+
+	void PushBack(T const& value)
+	{
+		auto fields = Reflection::Tie(value);
+		Reflection::ForEachField<T>([&](auto field) { std::get<field>(columns).push_back(std::get<field>(fields)); });
+		++size;
+	}
+
+	void Resize(size_t count)
+	{
+		Reflection::ForEachField<T>([&](auto field) { std::get<field>(columns).resize(count); });
+		size = count;
+	}
+
+	void Reserve(size_t count)
+	{
+		Reflection::ForEachField<T>([&](auto field) { std::get<field>(columns).reserve(count); });
+	}
+
+	// Invalidated by anything that grows the container
+	template<size_t Field>
+	std::span<FieldType<Field>> Column() { return std::get<Field>(columns); }
+
+	template<size_t Field>
+	std::span<FieldType<Field> const> Column() const { return std::get<Field>(columns); }
+
+	// Reassembles the element, each field comes from a different array
+	T Get(size_t index) const
+	{
+		return [&]<size_t... I>(std::index_sequence<I...>) { return T{ std::get<I>(columns)[index]... }; }(std::make_index_sequence<k_fieldCount>{});
+	}
+
+	void Set(size_t index, T const& value)
+	{
+		auto fields = Reflection::Tie(value);
+		Reflection::ForEachField<T>([&](auto field) { std::get<field>(columns)[index] = std::get<field>(fields); });
+	}
+
+	size_t Size() const { return size; }
+
+private:
+	template<typename Field>
+	using Vector = std::vector<Field>;
+
+	typename Reflection::WrapFields<Vector, Reflection::FieldTypes<T>>::Type columns;
+	size_t size = 0;
+};
+
+template<typename T, size_t TileWidth>
+class AosoaVector
+{
+public:
+	static_assert(std::is_aggregate_v<T>, "AosoaVector needs an aggregate to split into columns");
+	static_assert(TileWidth > 0);
+
+	static constexpr size_t k_fieldCount = Reflection::k_fieldCount<T>;
+	static constexpr size_t k_tileWidth = TileWidth;
+
+	template<size_t Field>
+	using FieldType = std::tuple_element_t<Field, Reflection::FieldTypes<T>>;
+
+	void PushBack(T const& value)
+	{
+		if (size % TileWidth == 0) tiles.emplace_back();
+		++size;
+		Set(size - 1, value);
+	}
+
+	// New elements in a partially filled tile are value initialized along with the rest of the tile
+	void Resize(size_t count)
+	{
+		tiles.resize((count + TileWidth - 1) / TileWidth);
+		size = count;
+	}
+
+	void Reserve(size_t count)
+	{
+		tiles.reserve((count + TileWidth - 1) / TileWidth);
+	}
+
+	size_t TileCount() const { return tiles.size(); }
+
+	// One field of one tile, the last tile's column only covers the elements in use
+	template<size_t Field>
+	std::span<FieldType<Field>> Column(size_t tile)
+	{
+		return std::span(std::get<Field>(tiles[tile].columns)).first(TileSize(tile));
+	}
+
+	template<size_t Field>
+	std::span<FieldType<Field> const> Column(size_t tile) const
+	{
+		return std::span(std::get<Field>(tiles[tile].columns)).first(TileSize(tile));
+	}
+
+	template<size_t Field>
+	FieldType<Field>& At(size_t index) { return std::get<Field>(tiles[index / TileWidth].columns)[index % TileWidth]; }
+
+	template<size_t Field>
+	FieldType<Field> const& At(size_t index) const { return std::get<Field>(tiles[index / TileWidth].columns)[index % TileWidth]; }
+
+	T Get(size_t index) const
+	{
+		return [&]<size_t... I>(std::index_sequence<I...>) { return T{ At<I>(index)... }; }(std::make_index_sequence<k_fieldCount>{});
+	}
+
+	void Set(size_t index, T const& value)
+	{
+		auto fields = Reflection::Tie(value);
+		Reflection::ForEachField<T>([&](auto field) { At<field>(index) = std::get<field>(fields); });
+	}
+
+	size_t Size() const { return size; }
+
+private:
+	template<typename Field>
+	using TileArray = std::array<Field, TileWidth>;
+
+	// Cache line aligned so a tile's first column always starts a line
+	struct alignas(64) Tile
+	{
+		typename Reflection::WrapFields<TileArray, Reflection::FieldTypes<T>>::Type columns{};
+	};
+
+	size_t TileSize(size_t tile) const { return std::min(TileWidth, size - tile * TileWidth); }
+
+	std::vector<Tile> tiles;
+	size_t size = 0;
+};
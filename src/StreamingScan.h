@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <semaphore>
+#include <span>
+#include <thread>
+#include "Profiler.h"
+
+// Scans a file that does not fit in memory by streaming it through a small ring of chunk buffers. A reader thread fills
+// the next buffers while the calling thread runs its compare over the current one, so with two or more buffers the
+// scan runs at the speed of the slower of the disk and the compare instead of the sum of both.
+//
+// Reads bypass the page cache where the OS allows it (O_DIRECT, FILE_FLAG_NO_BUFFERING): a one pass scan over more data
+// than fits in RAM would only evict everything else from the cache, and copying through it costs memory bandwidth the
+// compare could use. Bypassing needs sector aligned buffers, offsets and sizes, so chunks are multiples of
+// k_directIoAlignment and the scanned range is widened to aligned reads and trimmed again before the compare sees it.
+// File systems that refuse unbuffered reads (tmpfs) fall back to buffered reads, IsDirect says which one is in use.
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace StreamingScan
+{
+	constexpr size_t k_directIoAlignment = 4096;
+	constexpr uint32_t k_maxBuffers = 8;
+
+	struct ScanStats
+	{
+		uint64_t bytesScanned = 0;
+		uint64_t chunkCount = 0;
+		uint64_t totalCycles = 0;
+		uint64_t readWaitCycles = 0; // Time the compare spent waiting for a chunk, near zero once the disk keeps up
+	};
+
+	class FileScanner
+	{
+	public:
+		// chunkBytes is rounded up to k_directIoAlignment, bufferCount of 1 reads and compares in turn without overlap
+		FileScanner(char const* path, size_t chunkBytes, uint32_t bufferCount = 3)
+			: chunkBytes(AlignUp(std::max<size_t>(chunkBytes, 1)))
+			, bufferCount(std::clamp<uint32_t>(bufferCount, 1, k_maxBuffers))
+		{
+			if (!Open(path)) return;
+
+			buffers = (std::byte*)::operator new(this->chunkBytes * this->bufferCount, std::align_val_t{ k_directIoAlignment });
+		}
+
+		~FileScanner()
+		{
+			if (buffers) ::operator delete(buffers, std::align_val_t{ k_directIoAlignment });
+			Close();
+		}
+
+		FileScanner(FileScanner const&) = delete;
+		FileScanner& operator=(FileScanner const&) = delete;
+
+		bool IsOpen() const { return buffers != nullptr; }
+		bool IsDirect() const { return direct; }
+		char const* GetError() const { return error; }
+
+		uint64_t FileSize() const { return fileSize; }
+		size_t ChunkBytes() const { return chunkBytes; }
+		uint32_t BufferCount() const { return bufferCount; }
+
+		ScanStats const& GetLastScanStats() const { return stats; }
+
+		// Calls fn(std::span<std::byte const>) with consecutive pieces of [begin, begin + size) in file order. fn returns
+		// false to stop early. Returns the bytes handed to fn, less than size if it stopped or a read failed (see GetError)
+		template<typename Fn>
+		uint64_t Scan(uint64_t begin, uint64_t size, Fn const& fn)
+		{
+			stats = {};
+			if (!IsOpen()) return 0;
+
+			uint64_t end = std::min(begin + size, fileSize);
+			if (begin >= end) return 0;
+
+			uint64_t scanStart = Profiler::ReadCpuTimer();
+			uint64_t firstRead = begin / k_directIoAlignment * k_directIoAlignment;
+			uint64_t chunkCount = (end - firstRead + chunkBytes - 1) / chunkBytes;
+
+			// Slots go round the ring in chunk order. free counts slots the reader may fill, filled slots the compare may use
+			std::counting_semaphore<> freeSlots(bufferCount);
+			std::counting_semaphore<> filledSlots(0);
+			std::atomic<bool> stop = false;
+			size_t readBytes[k_maxBuffers] = {};
+			error = nullptr;
+
+			std::thread reader([&] {
+				for (uint64_t chunk = 0; chunk < chunkCount; ++chunk)
+				{
+					freeSlots.acquire();
+					if (stop.load(std::memory_order_relaxed)) return;
+
+					uint32_t slot = (uint32_t)(chunk % bufferCount);
+					uint64_t offset = firstRead + chunk * chunkBytes;
+					size_t bytes = (size_t)std::min<uint64_t>(chunkBytes, AlignUp(end - offset));
+					size_t bytesRead = ReadAt(offset, buffers + slot * chunkBytes, bytes);
+					readBytes[slot] = bytesRead;
+					filledSlots.release();
+
+					// A short read ends the scan, the compare sees it and stops taking chunks
+					if (bytesRead < std::min<uint64_t>(bytes, end - offset)) return;
+				}
+			});
+
+			uint64_t scanned = 0;
+			for (uint64_t chunk = 0; chunk < chunkCount; ++chunk)
+			{
+				uint64_t waitStart = Profiler::ReadCpuTimer();
+				filledSlots.acquire();
+				stats.readWaitCycles += Profiler::ReadCpuTimer() - waitStart;
+
+				uint32_t slot = (uint32_t)(chunk % bufferCount);
+				uint64_t offset = firstRead + chunk * chunkBytes;
+				uint64_t readEnd = offset + readBytes[slot];
+				uint64_t validBegin = std::max(offset, begin);
+				uint64_t validEnd = std::min(readEnd, end);
+
+				bool keepGoing = true;
+				if (validBegin < validEnd)
+				{
+					keepGoing = fn(std::span<std::byte const>(buffers + slot * chunkBytes + (validBegin - offset), (size_t)(validEnd - validBegin)));
+					scanned += validEnd - validBegin;
+					++stats.chunkCount;
+				}
+
+				bool shortRead = readEnd < std::min(offset + chunkBytes, end);
+				if (shortRead) error = "Read failed before the end of the range";
+
+				// The reader may be waiting for a free slot, hand it all of them so it wakes up and sees the stop
+				if (shortRead || !keepGoing)
+				{
+					stop.store(true, std::memory_order_relaxed);
+					freeSlots.release(bufferCount);
+					break;
+				}
+
+				freeSlots.release();
+			}
+
+			reader.join();
+			stats.bytesScanned = scanned;
+			stats.totalCycles = Profiler::ReadCpuTimer() - scanStart;
+			return scanned;
+		}
+
+		// Scan over a range of T, the range must start on an element boundary
+		template<typename T, typename Fn>
+		uint64_t ScanElements(uint64_t begin, uint64_t count, Fn const& fn)
+		{
+			static_assert(k_directIoAlignment % sizeof(T) == 0, "Elements must not straddle chunks");
+
+			uint64_t bytes = Scan(begin, count * sizeof(T), [&](std::span<std::byte const> chunk) {
+				return fn(std::span<T const>((T const*)chunk.data(), chunk.size() / sizeof(T)));
+			});
+
+			return bytes / sizeof(T);
+		}
+
+	private:
+		static uint64_t AlignUp(uint64_t value)
+		{
+			return (value + k_directIoAlignment - 1) / k_directIoAlignment * k_directIoAlignment;
+		}
+
+#if _WIN32
+		bool Open(char const* path)
+		{
+			DWORD const flags = FILE_FLAG_SEQUENTIAL_SCAN;
+			file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags | FILE_FLAG_NO_BUFFERING, nullptr);
+			direct = file != INVALID_HANDLE_VALUE;
+			if (!direct) file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+			if (file == INVALID_HANDLE_VALUE) return Fail("Unable to open file");
+
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size)) return Fail("Unable to read file size");
+
+			fileSize = (uint64_t)size.QuadPart;
+			return true;
+		}
+
+		void Close()
+		{
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+
+		// Returns fewer bytes than asked for at the end of the file or on an error
+		size_t ReadAt(uint64_t offset, std::byte* destination, size_t bytes)
+		{
+			OVERLAPPED position = {};
+			position.Offset = (DWORD)offset;
+			position.OffsetHigh = (DWORD)(offset >> 32);
+
+			DWORD bytesRead = 0;
+			ReadFile(file, destination, (DWORD)bytes, &bytesRead, &position);
+			return bytesRead;
+		}
+
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		bool Open(char const* path)
+		{
+#ifdef O_DIRECT
+			fd = open(path, O_RDONLY | O_DIRECT);
+			direct = fd >= 0;
+#endif
+			if (fd < 0) fd = open(path, O_RDONLY);
+			if (fd < 0) return Fail("Unable to open file");
+
+			off_t size = lseek(fd, 0, SEEK_END);
+			if (size < 0) return Fail("Unable to read file size");
+
+			fileSize = (uint64_t)size;
+#ifdef POSIX_FADV_SEQUENTIAL
+			// Only matters for buffered reads, lets the kernel read further ahead
+			if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef __APPLE__
+			// macOS has no O_DIRECT, turning the cache off for the file is the closest equivalent
+			direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
+			return true;
+		}
+
+		void Close()
+		{
+			if (fd >= 0) close(fd);
+			fd = -1;
+		}
+
+		// Returns fewer bytes than asked for at the end of the file or on an error
+		size_t ReadAt(uint64_t offset, std::byte* destination, size_t bytes)
+		{
+			size_t total = 0;
+			while (total < bytes)
+			{
+				ssize_t result = pread(fd, destination + total, bytes - total, (off_t)(offset + total));
+				if (result <= 0) break;
+
+				total += (size_t)result;
+			}
+
+			return total;
+		}
+
+		int fd = -1;
+#endif
+
+		bool Fail(char const* reason)
+		{
+			error = reason;
+			return false;
+		}
+
+		size_t chunkBytes;
+		uint32_t bufferCount;
+		std::byte* buffers = nullptr;
+		uint64_t fileSize = 0;
+		bool direct = false;
+		char const* error = nullptr;
+		ScanStats stats;
+	};
+
+} // namespace StreamingScan
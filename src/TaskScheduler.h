@@ -0,0 +1,526 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <source_location>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+// Work stealing scheduler for fork/join parallelism. Every worker owns a Chase-Lev deque: it pushes and pops tasks at the
+// bottom without contention, and idle workers steal the oldest (usually largest) task from the top of someone else's.
+// The thread that calls Run is worker 0 for the duration of the call, so Spawn and Wait are only valid inside Run or a task.
+// Tasks spawned with a label are timed with the profiler under that label and the spawn site's line, so PrintResults shows
+// per task latency next to the per worker steal and idle counts from PrintStats.
+
+// Counts the tasks spawned into it that have not finished yet
+struct TaskGroup
+{
+	std::atomic<uint32_t> pending = 0;
+};
+
+struct SchedulerWorkerStats
+{
+	uint64_t tasksExecuted = 0;
+	uint64_t steals = 0;
+	uint64_t failedSteals = 0;
+	uint64_t idleCycles = 0;
+};
+
+class TaskScheduler
+{
+public:
+	// A task's captures are stored inline, so spawning never allocates once the free lists are warm
+	static constexpr size_t k_taskStorageSize = 64;
+	static constexpr uint32_t k_dequeCapacity = 4096;
+	static constexpr uint32_t k_maxTaskLabels = 64;
+
+	static TaskScheduler& Get()
+	{
+		static TaskScheduler instance(std::max(1u, std::thread::hardware_concurrency()));
+		return instance;
+	}
+
+	explicit TaskScheduler(uint32_t workerCount)
+		: deques(std::max(1u, workerCount))
+		, stats(std::max(1u, workerCount))
+	{
+		for (uint32_t workerIndex = 1; workerIndex < deques.size(); ++workerIndex)
+		{
+			workers.emplace_back([this, workerIndex] { WorkerLoop(workerIndex); });
+		}
+	}
+
+	~TaskScheduler()
+	{
+		{
+			std::lock_guard lock(sleepMutex);
+			stopping = true;
+		}
+
+		wakeWorkers.notify_all();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	TaskScheduler(TaskScheduler const&) = delete;
+	TaskScheduler& operator=(TaskScheduler const&) = delete;
+
+	uint32_t WorkerCount() const { return (uint32_t)deques.size(); }
+
+	// Runs fn as worker 0, calls from several outside threads take turns
+	template<typename Fn>
+	void Run(Fn const& fn)
+	{
+		if (t_scheduler == this)
+		{
+			fn();
+			return;
+		}
+
+		std::lock_guard lock(externalMutex);
+		t_scheduler = this;
+		t_workerIndex = 0;
+		fn();
+		t_scheduler = nullptr;
+	}
+
+	// Queues fn on this worker's deque, or runs it straight away if the deque is full or this is not inside Run
+	template<typename Fn>
+	void Spawn(TaskGroup& group, Fn&& fn, char const* label = nullptr, std::source_location location = std::source_location::current())
+	{
+		if (t_scheduler != this)
+		{
+			fn();
+			return;
+		}
+
+		using Callable = std::decay_t<Fn>;
+		static_assert(sizeof(Callable) <= k_taskStorageSize, "Task captures too much, capture a pointer to a struct instead");
+		static_assert(alignof(Callable) <= alignof(std::max_align_t));
+
+		Task* task = AllocateTask();
+		new (task->storage) Callable(std::forward<Fn>(fn));
+		task->invoke = [](Task& self) { (*std::launder((Callable*)self.storage))(); };
+		task->destroy = [](Task& self) { std::launder((Callable*)self.storage)->~Callable(); };
+		task->group = &group;
+		task->label = label;
+		task->lineNumber = (int)location.line();
+
+		group.pending.fetch_add(1, std::memory_order_relaxed);
+		if (!deques[t_workerIndex].Push(task))
+		{
+			Execute(task);
+			return;
+		}
+
+		// Pairs with the fence in Sleep, either the sleeper sees the task or this sees the sleeper
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleepingWorkers.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard lock(sleepMutex);
+			wakeWorkers.notify_one();
+		}
+	}
+
+	// Runs this worker's tasks, or steals others, until every task in the group has finished
+	void Wait(TaskGroup& group)
+	{
+		uint32_t workerIndex = t_workerIndex;
+		uint64_t idleStart = 0;
+		while (group.pending.load(std::memory_order_acquire) != 0)
+		{
+			Task* task = deques[workerIndex].Pop();
+			if (!task) task = TrySteal(workerIndex);
+
+			if (task)
+			{
+				if (idleStart) AddIdleCycles(workerIndex, Profiler::ReadCpuTimer() - idleStart);
+				idleStart = 0;
+				Execute(task);
+			}
+			else
+			{
+				if (!idleStart) idleStart = Profiler::ReadCpuTimer();
+				_mm_pause();
+			}
+		}
+
+		if (idleStart) AddIdleCycles(workerIndex, Profiler::ReadCpuTimer() - idleStart);
+	}
+
+	// Runs a and b in parallel and returns once both have finished
+	template<typename FnA, typename FnB>
+	void ForkJoin(FnA const& a, FnB const& b, char const* label = nullptr, std::source_location location = std::source_location::current())
+	{
+		TaskGroup group;
+		Spawn(group, [&b] { b(); }, label, location);
+		a();
+		Wait(group);
+	}
+
+	// fn(begin, end) over ranges of at most grainSize elements, split in halves so thieves take the big halves
+	template<typename Fn>
+	void ParallelFor(size_t begin, size_t end, size_t grainSize, Fn const& fn, char const* label = nullptr, std::source_location location = std::source_location::current())
+	{
+		Run([&] {
+			TaskGroup group;
+			SplitRange(group, begin, end, std::max<size_t>(grainSize, 1), fn, label, location);
+			Wait(group);
+		});
+	}
+
+	SchedulerWorkerStats GetStats(uint32_t workerIndex) const
+	{
+		WorkerStats const& worker = stats[workerIndex].value;
+		return { worker.tasksExecuted.load(std::memory_order_relaxed), worker.steals.load(std::memory_order_relaxed),
+			worker.failedSteals.load(std::memory_order_relaxed), worker.idleCycles.load(std::memory_order_relaxed) };
+	}
+
+	void ResetStats()
+	{
+		for (CacheLinePadded<WorkerStats>& worker : stats)
+		{
+			worker.value.tasksExecuted.store(0, std::memory_order_relaxed);
+			worker.value.steals.store(0, std::memory_order_relaxed);
+			worker.value.failedSteals.store(0, std::memory_order_relaxed);
+			worker.value.idleCycles.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Idle time counts workers spinning or asleep waiting for work, including waits inside Wait
+	void PrintStats() const
+	{
+		uint64_t frequency = Profiler::CpuStats::Get().k_CpuFrequencyHz;
+		for (uint32_t workerIndex = 0; workerIndex < WorkerCount(); ++workerIndex)
+		{
+			SchedulerWorkerStats worker = GetStats(workerIndex);
+			std::cout << "Worker " << workerIndex << ": " << worker.tasksExecuted << " tasks, " << worker.steals << " steals, "
+				<< worker.failedSteals << " failed steals";
+			if (frequency)
+			{
+				std::cout << ", " << (double)worker.idleCycles / (double)frequency << "s idle";
+			}
+			std::cout << "\n";
+		}
+	}
+
+private:
+	struct Task
+	{
+		void (*invoke)(Task&) = nullptr;
+		void (*destroy)(Task&) = nullptr;
+		TaskGroup* group = nullptr;
+		char const* label = nullptr;
+		int lineNumber = 0;
+		Task* nextFree = nullptr;
+		alignas(std::max_align_t) unsigned char storage[k_taskStorageSize];
+	};
+
+	// Fixed capacity Chase-Lev deque, following the C11 version by Le, Pop, Cohen and Zappa Nardelli.
+	// Only the owner calls Push and Pop, any thread may call Steal
+	class WorkStealingDeque
+	{
+	public:
+		bool Push(Task* task)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t t = top.load(std::memory_order_acquire);
+			if (b - t >= (int64_t)k_dequeCapacity) return false;
+
+			buffer[b & (k_dequeCapacity - 1)].store(task, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_release);
+			return true;
+		}
+
+		Task* Pop()
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+
+			if (t > b)
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			Task* task = buffer[b & (k_dequeCapacity - 1)].load(std::memory_order_relaxed);
+			if (t == b)
+			{
+				// Last task, race the thieves for it
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+
+			return task;
+		}
+
+		// Returns nullptr if the deque was empty or another thread won the race, lost says which
+		Task* Steal(bool& lost)
+		{
+			lost = false;
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b) return nullptr;
+
+			Task* task = buffer[t & (k_dequeCapacity - 1)].load(std::memory_order_relaxed);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				lost = true;
+				return nullptr;
+			}
+
+			return task;
+		}
+
+		bool MaybeHasWork() const
+		{
+			return top.load(std::memory_order_acquire) < bottom.load(std::memory_order_acquire);
+		}
+
+	private:
+		// Thieves hammer top while the owner works on bottom, keep them on separate cache lines
+		alignas(64) std::atomic<int64_t> top = 0;
+		alignas(64) std::atomic<int64_t> bottom = 0;
+		alignas(64) std::atomic<Task*> buffer[k_dequeCapacity] = {};
+	};
+
+	struct WorkerStats
+	{
+		std::atomic<uint64_t> tasksExecuted = 0;
+		std::atomic<uint64_t> steals = 0;
+		std::atomic<uint64_t> failedSteals = 0;
+		std::atomic<uint64_t> idleCycles = 0;
+	};
+
+	// Finished tasks go back on the free list of the thread that ran them
+	struct TaskFreeList
+	{
+		Task* head = nullptr;
+
+		~TaskFreeList()
+		{
+			while (head)
+			{
+				Task* next = head->nextFree;
+				delete head;
+				head = next;
+			}
+		}
+	};
+
+	// Profiler anchors for labelled tasks, one table per thread like the ProfileBlock anchors
+	struct TaskLabelAnchors
+	{
+		Profiler::ProfileResult* anchors = nullptr;
+		char const* labels[k_maxTaskLabels] = {};
+		int lineNumbers[k_maxTaskLabels] = {};
+		uint32_t count = 0;
+	};
+
+	static inline thread_local TaskScheduler* t_scheduler = nullptr;
+	static inline thread_local uint32_t t_workerIndex = 0;
+	static thread_local TaskFreeList t_freeTasks;
+	static thread_local TaskLabelAnchors t_labelAnchors;
+
+	static Task* AllocateTask()
+	{
+		Task* task = t_freeTasks.head;
+		if (!task) return new Task;
+
+		t_freeTasks.head = task->nextFree;
+		return task;
+	}
+
+	static void FreeTask(Task* task)
+	{
+		task->nextFree = t_freeTasks.head;
+		t_freeTasks.head = task;
+	}
+
+	// Labels past k_maxTaskLabels on a thread run unprofiled
+	static Profiler::ProfileResult* GetLabelAnchor(char const* label, int lineNumber)
+	{
+		TaskLabelAnchors& table = t_labelAnchors;
+		for (uint32_t i = 0; i < table.count; ++i)
+		{
+			if (table.labels[i] == label && table.lineNumbers[i] == lineNumber) return &table.anchors[i];
+		}
+
+		if (table.count == k_maxTaskLabels) return nullptr;
+		if (!table.anchors)
+		{
+			table.anchors = Profiler::ProfilerResultsHolder::Get().CreateThreadAnchorTable(k_maxTaskLabels);
+		}
+
+		table.labels[table.count] = label;
+		table.lineNumbers[table.count] = lineNumber;
+		return &table.anchors[table.count++];
+	}
+
+	void Execute(Task* task)
+	{
+		TaskGroup* group = task->group;
+		Profiler::ProfileResult* anchor = task->label ? GetLabelAnchor(task->label, task->lineNumber) : nullptr;
+		if (anchor)
+		{
+			Profiler::ScopedProfiler profile(*anchor, task->label, task->lineNumber);
+			task->invoke(*task);
+		}
+		else
+		{
+			task->invoke(*task);
+		}
+
+		task->destroy(*task);
+		FreeTask(task);
+
+		std::atomic<uint64_t>& executed = stats[t_workerIndex].value.tasksExecuted;
+		executed.store(executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		group->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	// Tries every other worker once, starting from a random victim so thieves spread out
+	Task* TrySteal(uint32_t workerIndex)
+	{
+		uint32_t workerCount = WorkerCount();
+		if (workerCount == 1) return nullptr;
+
+		WorkerStats& worker = stats[workerIndex].value;
+		uint32_t start = NextRandom() % workerCount;
+		for (uint32_t i = 0; i < workerCount; ++i)
+		{
+			uint32_t victim = (start + i) % workerCount;
+			if (victim == workerIndex) continue;
+
+			bool lost = false;
+			if (Task* task = deques[victim].Steal(lost))
+			{
+				worker.steals.store(worker.steals.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return task;
+			}
+
+			if (lost) worker.failedSteals.store(worker.failedSteals.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		return nullptr;
+	}
+
+	static uint32_t NextRandom()
+	{
+		// xorshift32, per thread so thieves do not share state
+		static thread_local uint32_t state = (uint32_t)std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	void AddIdleCycles(uint32_t workerIndex, uint64_t cycles)
+	{
+		std::atomic<uint64_t>& idle = stats[workerIndex].value.idleCycles;
+		idle.store(idle.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+	}
+
+	bool AnyWorkAvailable() const
+	{
+		for (WorkStealingDeque const& deque : deques)
+		{
+			if (deque.MaybeHasWork()) return true;
+		}
+
+		return false;
+	}
+
+	template<typename Fn>
+	void SplitRange(TaskGroup& group, size_t begin, size_t end, size_t grainSize, Fn const& fn, char const* label, std::source_location location)
+	{
+		while (end - begin > grainSize)
+		{
+			size_t middle = begin + (end - begin) / 2;
+			Spawn(group, [this, &group, middle, end, grainSize, &fn, label, location] {
+				SplitRange(group, middle, end, grainSize, fn, label, location);
+			}, label, location);
+			end = middle;
+		}
+
+		fn(begin, end);
+	}
+
+	void WorkerLoop(uint32_t workerIndex)
+	{
+		t_scheduler = this;
+		t_workerIndex = workerIndex;
+
+		uint32_t failedAttempts = 0;
+		uint64_t idleStart = 0;
+		while (true)
+		{
+			Task* task = deques[workerIndex].Pop();
+			if (!task) task = TrySteal(workerIndex);
+
+			if (task)
+			{
+				if (idleStart) AddIdleCycles(workerIndex, Profiler::ReadCpuTimer() - idleStart);
+				idleStart = 0;
+				failedAttempts = 0;
+				Execute(task);
+				continue;
+			}
+
+			if (!idleStart) idleStart = Profiler::ReadCpuTimer();
+			if (++failedAttempts < k_spinAttempts)
+			{
+				_mm_pause();
+				continue;
+			}
+
+			failedAttempts = 0;
+			if (!Sleep()) break;
+		}
+
+		if (idleStart) AddIdleCycles(workerIndex, Profiler::ReadCpuTimer() - idleStart);
+	}
+
+	// Returns false once the scheduler is shutting down
+	bool Sleep()
+	{
+		std::unique_lock lock(sleepMutex);
+		sleepingWorkers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		wakeWorkers.wait(lock, [&] { return stopping || AnyWorkAvailable(); });
+		sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+		return !stopping;
+	}
+
+	static constexpr uint32_t k_spinAttempts = 1024;
+
+	std::vector<WorkStealingDeque> deques;
+	std::vector<CacheLinePadded<WorkerStats>> stats;
+	std::vector<std::thread> workers;
+
+	std::mutex externalMutex;
+	std::mutex sleepMutex;
+	std::condition_variable wakeWorkers;
+	std::atomic<uint32_t> sleepingWorkers = 0;
+	bool stopping = false;
+};
+
+inline thread_local TaskScheduler::TaskFreeList TaskScheduler::t_freeTasks;
+inline thread_local TaskScheduler::TaskLabelAnchors TaskScheduler::t_labelAnchors;
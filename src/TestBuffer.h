@@ -0,0 +1,193 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+//Memory for repetition tests, allocated according to a policy so that the cost of the OS mapping and zeroing pages
+//can be measured separately from the bandwidth of the code under test.
+// Fresh: a new mapping every test, so each test pays for first touch page faults
+// Reused: mapped once, only the first test faults
+// PreFaulted: mapped once with every page faulted in up front (MAP_POPULATE)
+// TransparentHugePages: mapped once and 2mb aligned, with the kernel asked to back it with huge pages
+// ExplicitHugePages: mapped once from the reserved huge page pool (MAP_HUGETLB / MEM_LARGE_PAGES), needs pages reserved by the admin
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+enum class BufferPolicy
+{
+	Fresh,
+	Reused,
+	PreFaulted,
+	TransparentHugePages,
+	ExplicitHugePages,
+};
+
+constexpr BufferPolicy k_bufferPolicies[] = {
+	BufferPolicy::Fresh,
+	BufferPolicy::Reused,
+	BufferPolicy::PreFaulted,
+	BufferPolicy::TransparentHugePages,
+	BufferPolicy::ExplicitHugePages,
+};
+
+inline char const* GetBufferPolicyName(BufferPolicy policy)
+{
+	switch (policy)
+	{
+	case BufferPolicy::Fresh: return "fresh";
+	case BufferPolicy::Reused: return "reused";
+	case BufferPolicy::PreFaulted: return "prefaulted";
+	case BufferPolicy::TransparentHugePages: return "transparent huge pages";
+	case BufferPolicy::ExplicitHugePages: return "explicit huge pages";
+	}
+
+	return "unknown";
+}
+
+class TestBuffer
+{
+public:
+	TestBuffer(BufferPolicy bufferPolicy, size_t bufferSize)
+		: policy(bufferPolicy)
+		, size(bufferSize)
+	{
+		if (policy != BufferPolicy::Fresh)
+		{
+			data = Map();
+		}
+	}
+
+	~TestBuffer()
+	{
+		Unmap();
+	}
+
+	TestBuffer(TestBuffer const&) = delete;
+	TestBuffer& operator=(TestBuffer const&) = delete;
+
+	// Call before every test, outside of the timed region. Returns nullptr if the policy is not available on this machine
+	uint8_t* Acquire()
+	{
+		if (policy == BufferPolicy::Fresh)
+		{
+			Unmap();
+			data = Map();
+		}
+
+		return data;
+	}
+
+	size_t Size() const { return size; }
+
+private:
+	static constexpr size_t k_hugePageSize = 2 * 1024 * 1024;
+
+#if _WIN32
+	uint8_t* Map()
+	{
+		DWORD allocationType = MEM_RESERVE | MEM_COMMIT;
+		size_t mappedSize = size;
+		if (policy == BufferPolicy::ExplicitHugePages)
+		{
+			// Requires SeLockMemoryPrivilege for the user running the tests
+			size_t largePageSize = GetLargePageMinimum();
+			if (largePageSize == 0) return Unavailable();
+			mappedSize = (size + largePageSize - 1) / largePageSize * largePageSize;
+			allocationType |= MEM_LARGE_PAGES;
+		}
+		else if (policy == BufferPolicy::TransparentHugePages)
+		{
+			// Windows only hands out large pages explicitly
+			return Unavailable();
+		}
+
+		uint8_t* mapped = (uint8_t*)VirtualAlloc(nullptr, mappedSize, allocationType, PAGE_READWRITE);
+		if (!mapped) return Unavailable();
+
+		if (policy == BufferPolicy::PreFaulted)
+		{
+			// No populate flag on Windows, touch every page instead
+			for (size_t offset = 0; offset < size; offset += 4096)
+			{
+				mapped[offset] = 0;
+			}
+		}
+
+		return mapped;
+	}
+
+	void Unmap()
+	{
+		if (data) VirtualFree(data, 0, MEM_RELEASE);
+		data = nullptr;
+	}
+#else
+	uint8_t* Map()
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		size_t mappedSize = size;
+		if (policy == BufferPolicy::PreFaulted) flags |= MAP_POPULATE;
+		if (policy == BufferPolicy::ExplicitHugePages)
+		{
+			flags |= MAP_HUGETLB | MAP_POPULATE;
+			mappedSize = (size + k_hugePageSize - 1) / k_hugePageSize * k_hugePageSize;
+		}
+		if (policy == BufferPolicy::TransparentHugePages)
+		{
+			// Over allocate so the buffer can start on a huge page boundary
+			mappedSize = size + k_hugePageSize;
+		}
+
+		void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (mapped == MAP_FAILED) return Unavailable();
+
+		mappingBase = mapped;
+		mappingSize = mappedSize;
+		uint8_t* buffer = (uint8_t*)mapped;
+
+		if (policy == BufferPolicy::TransparentHugePages)
+		{
+			uintptr_t aligned = ((uintptr_t)mapped + k_hugePageSize - 1) & ~(uintptr_t)(k_hugePageSize - 1);
+			buffer = (uint8_t*)aligned;
+			if (madvise(buffer, size, MADV_HUGEPAGE) != 0)
+			{
+				Unmap();
+				return Unavailable();
+			}
+		}
+
+		return buffer;
+	}
+
+	void Unmap()
+	{
+		if (mappingBase) munmap(mappingBase, mappingSize);
+		mappingBase = nullptr;
+		mappingSize = 0;
+		data = nullptr;
+	}
+
+	void* mappingBase = nullptr;
+	size_t mappingSize = 0;
+#endif
+
+	uint8_t* Unavailable()
+	{
+		if (!reportedUnavailable)
+		{
+			std::cout << "Buffer policy " << GetBufferPolicyName(policy) << " is not available on this machine\n";
+			reportedUnavailable = true;
+		}
+
+		return nullptr;
+	}
+
+	BufferPolicy policy;
+	size_t size;
+	uint8_t* data = nullptr;
+	bool reportedUnavailable = false;
+};
@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+
+// Persistent pool of worker threads for data parallel loops. ParallelFor splits [0, count) into one contiguous chunk per
+// thread and the calling thread runs the first chunk itself, so a loop costs a wake up instead of thread creation.
+// Chunking is static and workers are pinned to CPUs in NUMA node order, so the same index range always runs on the same
+// node: fill data with the same ParallelFor split that later reads it and first touch places its pages on that node.
+// Workers spin for a while before sleeping, back to back loops never pay for a futex wake.
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+template<typename T>
+struct alignas(64) CacheLinePadded
+{
+	T value;
+};
+
+class ThreadPool
+{
+public:
+	// Chunk boundaries are multiples of this many elements, so no two threads write the same cache line of 4 byte elements
+	static constexpr size_t k_chunkGranularity = 16;
+
+	static ThreadPool& Get()
+	{
+		static ThreadPool instance(std::max(1u, std::thread::hardware_concurrency()));
+		return instance;
+	}
+
+	explicit ThreadPool(uint32_t threadCount)
+		: cpus(GetCpusInNumaOrder())
+	{
+		// Worker 0 is whichever thread calls ParallelFor
+		for (uint32_t workerIndex = 1; workerIndex < threadCount; ++workerIndex)
+		{
+			workers.emplace_back([this, workerIndex] { WorkerLoop(workerIndex); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+
+		wakeWorkers.notify_all();
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	uint32_t ThreadCount() const { return (uint32_t)workers.size() + 1; }
+
+	// fn(begin, end, workerIndex) runs once per thread, threadCount is clamped to the pool size.
+	// Loops from different threads are serialized, calling ParallelFor from inside fn deadlocks
+	template<typename Fn>
+	void ParallelFor(size_t count, uint32_t threadCount, Fn const& fn)
+	{
+		threadCount = std::clamp(threadCount, 1u, ThreadCount());
+		auto runChunk = [&](uint32_t workerIndex) {
+			size_t begin = ChunkBoundary(count, threadCount, workerIndex);
+			size_t end = ChunkBoundary(count, threadCount, workerIndex + 1);
+			if (begin < end) fn(begin, end, workerIndex);
+		};
+
+		if (threadCount == 1)
+		{
+			runChunk(0);
+			return;
+		}
+
+		std::lock_guard dispatchLock(dispatchMutex);
+		job = [](void* context, uint32_t workerIndex) { (*(decltype(runChunk)*)context)(workerIndex); };
+		jobContext = &runChunk;
+		remaining.store(threadCount - 1, std::memory_order_relaxed);
+		{
+			std::lock_guard lock(mutex);
+			uint64_t sequence = (generation.load(std::memory_order_relaxed) >> 32) + 1;
+			generation.store((sequence << 32) | threadCount, std::memory_order_release);
+		}
+
+		wakeWorkers.notify_all();
+		runChunk(0);
+
+		// Yield eventually in case the workers are sharing this core
+		for (uint32_t spin = 0; remaining.load(std::memory_order_acquire) != 0; ++spin)
+		{
+			if (spin < k_spinIterations)
+			{
+				_mm_pause();
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// map(begin, end) reduces one chunk, combine folds the per thread results together in chunk order
+	template<typename T, typename MapFn, typename CombineFn>
+	T ParallelReduce(size_t count, uint32_t threadCount, T identity, MapFn const& map, CombineFn const& combine)
+	{
+		threadCount = std::clamp(threadCount, 1u, ThreadCount());
+
+		// Each thread writes its own cache line, so partial results never bounce between cores
+		std::unique_ptr<CacheLinePadded<T>[]> partials(new CacheLinePadded<T>[threadCount]);
+		for (uint32_t i = 0; i < threadCount; ++i)
+		{
+			partials[i].value = identity;
+		}
+
+		ParallelFor(count, threadCount, [&](size_t begin, size_t end, uint32_t workerIndex) {
+			partials[workerIndex].value = map(begin, end);
+		});
+
+		T total = identity;
+		for (uint32_t i = 0; i < threadCount; ++i)
+		{
+			total = combine(total, partials[i].value);
+		}
+
+		return total;
+	}
+
+private:
+	static constexpr uint32_t k_spinIterations = 1 << 14;
+
+	static size_t ChunkBoundary(size_t count, uint32_t threadCount, uint32_t chunk)
+	{
+		if (chunk >= threadCount) return count;
+		size_t boundary = count / threadCount * chunk / k_chunkGranularity * k_chunkGranularity;
+		return std::min(boundary, count);
+	}
+
+	void WorkerLoop(uint32_t workerIndex)
+	{
+		PinToCpu(workerIndex);
+
+		uint64_t seenGeneration = 0;
+		while (true)
+		{
+			uint64_t currentGeneration = generation.load(std::memory_order_acquire);
+			for (uint32_t spin = 0; currentGeneration == seenGeneration && spin < k_spinIterations; ++spin)
+			{
+				_mm_pause();
+				currentGeneration = generation.load(std::memory_order_acquire);
+			}
+
+			if (currentGeneration == seenGeneration)
+			{
+				std::unique_lock lock(mutex);
+				wakeWorkers.wait(lock, [&] { return stopping || generation.load(std::memory_order_acquire) != seenGeneration; });
+				if (stopping) return;
+				currentGeneration = generation.load(std::memory_order_acquire);
+			}
+
+			seenGeneration = currentGeneration;
+			uint32_t activeThreads = (uint32_t)currentGeneration;
+			if (workerIndex < activeThreads)
+			{
+				job(jobContext, workerIndex);
+				remaining.fetch_sub(1, std::memory_order_release);
+			}
+		}
+	}
+
+	// Worker i runs on the i-th CPU in NUMA node order, wrapping if there are more workers than CPUs
+	void PinToCpu(uint32_t workerIndex) const
+	{
+		if (cpus.empty()) return;
+		uint32_t cpu = cpus[workerIndex % cpus.size()];
+#if _WIN32
+		if (cpu < 64) SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+	}
+
+	// CPUs this process may run on, grouped by NUMA node so adjacent workers (and so adjacent chunks) share a node.
+	// Falls back to plain CPU order where the topology is not available
+	static std::vector<uint32_t> GetCpusInNumaOrder()
+	{
+		std::vector<uint32_t> ordered;
+#if _WIN32
+		DWORD_PTR processMask = 0;
+		DWORD_PTR systemMask = 0;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) return ordered;
+
+		for (uint32_t cpu = 0; cpu < 64; ++cpu)
+		{
+			if (processMask & ((DWORD_PTR)1 << cpu)) ordered.push_back(cpu);
+		}
+#else
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return ordered;
+
+		std::vector<bool> placed(CPU_SETSIZE, false);
+		for (uint32_t node = 0;; ++node)
+		{
+			std::ifstream cpuList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			if (!cpuList) break;
+
+			// Comma separated ranges, e.g. "0-15,64-79"
+			std::string range;
+			while (std::getline(cpuList, range, ','))
+			{
+				uint32_t first = 0;
+				uint32_t last = 0;
+				int parsed = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+				if (parsed < 1) continue;
+				if (parsed == 1) last = first;
+
+				for (uint32_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+				{
+					if (CPU_ISSET(cpu, &allowed) && !placed[cpu])
+					{
+						ordered.push_back(cpu);
+						placed[cpu] = true;
+					}
+				}
+			}
+		}
+
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed) && !placed[cpu]) ordered.push_back(cpu);
+		}
+#endif
+		return ordered;
+	}
+
+	std::vector<uint32_t> cpus;
+	std::vector<std::thread> workers;
+
+	std::mutex dispatchMutex;
+	std::mutex mutex;
+	std::condition_variable wakeWorkers;
+	// Loop sequence number in the high 32 bits and the number of threads taking part in the low 32 bits, read together so a
+	// worker that sleeps through a loop it is not part of cannot pair that loop's sequence with the next loop's thread count
+	std::atomic<uint64_t> generation = 0;
+	std::atomic<uint32_t> remaining = 0;
+	bool stopping = false;
+
+	// Written before generation is bumped, only read by the workers taking part, which the caller waits for
+	void (*job)(void*, uint32_t) = nullptr;
+	void* jobContext = nullptr;
+};
@@ -0,0 +1,191 @@
+; Memory bandwidth kernels for sweeping the cache hierarchy
+; void Fn(uint64_t byteCount, uint8_t* data, uint64_t workingSetMask)
+; Touches byteCount bytes in total, wrapping around a power of two working set of (workingSetMask + 1) bytes.
+; Each iteration issues four independent accesses of the kernel's width, byteCount must be a multiple of four times the width.
+; 32 byte kernels need AVX2 and 64 byte kernels need AVX-512F, check for them before calling.
+
+global Read8
+global Read16
+global Read32
+global Read64
+global Write8
+global Write16
+global Write32
+global Write64
+global ReadWrite8
+global ReadWrite16
+global ReadWrite32
+global ReadWrite64
+
+; Windows x64 passes the arguments in rcx, rdx, r8. System V (Linux, macOS) passes them in rdi, rsi, rdx
+%ifidn __OUTPUT_FORMAT__, win64
+	%define byteCount rcx
+	%define data rdx
+	%define mask r8
+%else
+	%define byteCount rdi
+	%define data rsi
+	%define mask rdx
+%endif
+
+; rax is the running offset, r10 the wrapped address for this iteration.
+; Only volatile registers (rax, r10, r11, xmm0-5) are used so nothing needs saving under either ABI
+%macro BandwidthLoopBegin 0
+	xor rax, rax
+	align 64
+.loop:
+	mov r10, rax
+	and r10, mask
+	add r10, data
+%endmacro
+
+; %1 bytes touched per iteration
+%macro BandwidthLoopEnd 1
+	add rax, %1
+	cmp rax, byteCount
+	jb .loop
+%endmacro
+
+section .text
+
+Read8:
+	BandwidthLoopBegin
+	mov r11, [r10]
+	mov r11, [r10 + 8]
+	mov r11, [r10 + 16]
+	mov r11, [r10 + 24]
+	BandwidthLoopEnd 32
+	ret
+
+Read16:
+	BandwidthLoopBegin
+	movdqu xmm0, [r10]
+	movdqu xmm1, [r10 + 16]
+	movdqu xmm2, [r10 + 32]
+	movdqu xmm3, [r10 + 48]
+	BandwidthLoopEnd 64
+	ret
+
+Read32:
+	BandwidthLoopBegin
+	vmovdqu ymm0, [r10]
+	vmovdqu ymm1, [r10 + 32]
+	vmovdqu ymm2, [r10 + 64]
+	vmovdqu ymm3, [r10 + 96]
+	BandwidthLoopEnd 128
+	vzeroupper
+	ret
+
+Read64:
+	BandwidthLoopBegin
+	vmovdqu64 zmm0, [r10]
+	vmovdqu64 zmm1, [r10 + 64]
+	vmovdqu64 zmm2, [r10 + 128]
+	vmovdqu64 zmm3, [r10 + 192]
+	BandwidthLoopEnd 256
+	vzeroupper
+	ret
+
+Write8:
+	xor r11, r11
+	BandwidthLoopBegin
+	mov [r10], r11
+	mov [r10 + 8], r11
+	mov [r10 + 16], r11
+	mov [r10 + 24], r11
+	BandwidthLoopEnd 32
+	ret
+
+Write16:
+	pxor xmm0, xmm0
+	BandwidthLoopBegin
+	movdqu [r10], xmm0
+	movdqu [r10 + 16], xmm0
+	movdqu [r10 + 32], xmm0
+	movdqu [r10 + 48], xmm0
+	BandwidthLoopEnd 64
+	ret
+
+Write32:
+	vpxor ymm0, ymm0, ymm0
+	BandwidthLoopBegin
+	vmovdqu [r10], ymm0
+	vmovdqu [r10 + 32], ymm0
+	vmovdqu [r10 + 64], ymm0
+	vmovdqu [r10 + 96], ymm0
+	BandwidthLoopEnd 128
+	vzeroupper
+	ret
+
+Write64:
+	vpxorq zmm0, zmm0, zmm0
+	BandwidthLoopBegin
+	vmovdqu64 [r10], zmm0
+	vmovdqu64 [r10 + 64], zmm0
+	vmovdqu64 [r10 + 128], zmm0
+	vmovdqu64 [r10 + 192], zmm0
+	BandwidthLoopEnd 256
+	vzeroupper
+	ret
+
+ReadWrite8:
+	BandwidthLoopBegin
+	add qword [r10], 1
+	add qword [r10 + 8], 1
+	add qword [r10 + 16], 1
+	add qword [r10 + 24], 1
+	BandwidthLoopEnd 32
+	ret
+
+ReadWrite16:
+	pcmpeqd xmm4, xmm4
+	BandwidthLoopBegin
+	movdqu xmm0, [r10]
+	movdqu xmm1, [r10 + 16]
+	movdqu xmm2, [r10 + 32]
+	movdqu xmm3, [r10 + 48]
+	paddq xmm0, xmm4
+	paddq xmm1, xmm4
+	paddq xmm2, xmm4
+	paddq xmm3, xmm4
+	movdqu [r10], xmm0
+	movdqu [r10 + 16], xmm1
+	movdqu [r10 + 32], xmm2
+	movdqu [r10 + 48], xmm3
+	BandwidthLoopEnd 64
+	ret
+
+ReadWrite32:
+	vpcmpeqd ymm4, ymm4, ymm4
+	BandwidthLoopBegin
+	vpaddq ymm0, ymm4, [r10]
+	vpaddq ymm1, ymm4, [r10 + 32]
+	vpaddq ymm2, ymm4, [r10 + 64]
+	vpaddq ymm3, ymm4, [r10 + 96]
+	vmovdqu [r10], ymm0
+	vmovdqu [r10 + 32], ymm1
+	vmovdqu [r10 + 64], ymm2
+	vmovdqu [r10 + 96], ymm3
+	BandwidthLoopEnd 128
+	vzeroupper
+	ret
+
+ReadWrite64:
+	vpternlogd zmm4, zmm4, zmm4, 0xFF
+	BandwidthLoopBegin
+	vpaddq zmm0, zmm4, [r10]
+	vpaddq zmm1, zmm4, [r10 + 64]
+	vpaddq zmm2, zmm4, [r10 + 128]
+	vpaddq zmm3, zmm4, [r10 + 192]
+	vmovdqu64 [r10], zmm0
+	vmovdqu64 [r10 + 64], zmm1
+	vmovdqu64 [r10 + 128], zmm2
+	vmovdqu64 [r10 + 192], zmm3
+	BandwidthLoopEnd 256
+	vzeroupper
+	ret
+
+%ifidn __OUTPUT_FORMAT__, elf64
+; Mark the stack as non executable, otherwise the linker makes the whole process stack executable
+section .note.GNU-stack noalloc noexec nowrite progbits
+%endif
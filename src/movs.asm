@@ -7,81 +7,96 @@ global Mov2x
 global Mov3x
 global Mov4x
 
+; void Fn(uint64_t count, uint8_t* data)
+; Windows x64 passes the arguments in rcx, rdx. System V (Linux, macOS) passes them in rdi, rsi
+%ifidn __OUTPUT_FORMAT__, win64
+	%define count rcx
+	%define data rdx
+%else
+	%define count rdi
+	%define data rsi
+%endif
+
 section .text
 
 Store1x:
 	align 64
 .loop:
-	mov [rdx], rax
-	sub rcx, 1
+	mov [data], rax
+	sub count, 1
 	jnle .loop
 	ret
 
 Store2x:
 	align 64
 .loop:
-	mov [rdx], rax
-	mov [rdx], rax
-	sub rcx, 2
+	mov [data], rax
+	mov [data], rax
+	sub count, 2
 	jnle .loop
 	ret
 
 Store3x:
 	align 64
 .loop:
-	mov [rdx], rax
-	mov [rdx], rax
-	mov [rdx], rax
-	sub rcx, 3
+	mov [data], rax
+	mov [data], rax
+	mov [data], rax
+	sub count, 3
 	jnle .loop
 	ret
 
 Store4x:
 	align 64
 .loop:
-	mov [rdx], rax
-	mov [rdx], rax
-	mov [rdx], rax
-	mov [rdx], rax
-	sub rcx, 4
+	mov [data], rax
+	mov [data], rax
+	mov [data], rax
+	mov [data], rax
+	sub count, 4
 	jnle .loop
 	ret
 
 Mov1x:
 	align 64
 .loop:
-	mov rax, [rdx]
-	sub rcx, 1
+	mov rax, [data]
+	sub count, 1
 	jnle .loop
 	ret
 
 Mov2x:
 	align 64
 .loop:
-	mov rax, [rdx]
-	mov rax, [rdx]
-	sub rcx, 2
+	mov rax, [data]
+	mov rax, [data]
+	sub count, 2
 	jnle .loop
 	ret
 
 
-	Mov3x:
+Mov3x:
 	align 64
 .loop:
-	mov rax, [rdx]
-	mov rax, [rdx]
-	mov rax, [rdx]
-	sub rcx, 3
+	mov rax, [data]
+	mov rax, [data]
+	mov rax, [data]
+	sub count, 3
 	jnle .loop
 	ret
 
-	Mov4x:
+Mov4x:
 	align 64
 .loop:
-	mov rax, [rdx]
-	mov rax, [rdx]
-	mov rax, [rdx]
-	mov rax, [rdx]
-	sub rcx, 4
+	mov rax, [data]
+	mov rax, [data]
+	mov rax, [data]
+	mov rax, [data]
+	sub count, 4
 	jnle .loop
-	ret
\ No newline at end of file
+	ret
+
+%ifidn __OUTPUT_FORMAT__, elf64
+; Mark the stack as non executable, otherwise the linker makes the whole process stack executable
+section .note.GNU-stack noalloc noexec nowrite progbits
+%endif